@@ -0,0 +1,211 @@
+// Benchmark of the two document models, through what they have in common
+// (see textmodel.h) and through how each one merges concurrent edits.
+//
+// $ ./bench [document|sequence|both] [ops]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "document.h"
+#include "operation.h"
+#include "sequence.h"
+#include "textmodel.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::to_string;
+using std::vector;
+
+// live heap bytes, counted by the operator new and delete below
+static std::atomic<size_t> heap_bytes(0);
+
+void* operator new(size_t size) {
+    // two words keep the block aligned like malloc's
+    size_t* block =
+        static_cast<size_t*>(std::malloc(size + 2 * sizeof(size_t)));
+    if(!block)
+        throw std::bad_alloc();
+    block[0] = size;
+    heap_bytes += size;
+    return block + 2;
+}
+
+void operator delete(void* ptr) noexcept {
+    if(!ptr)
+        return;
+    size_t* block = static_cast<size_t*>(ptr) - 2;
+    heap_bytes -= block[0];
+    std::free(block);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+static void report(const string& model,
+                   const string& workload,
+                   size_t ops,
+                   double seconds,
+                   size_t heap,
+                   size_t text) {
+    cout << std::left << std::setw(10) << model << std::setw(8) << workload
+         << std::right << std::setw(9) << ops << " ops " << std::fixed
+         << std::setprecision(3) << std::setw(8) << seconds << " s "
+         << std::setprecision(0) << std::setw(11) << ops / seconds
+         << " ops/s " << std::setprecision(1) << std::setw(8)
+         << heap / 1048576.0 << " MB heap " << std::setw(7)
+         << text / 1048576.0 << " MB text" << endl;
+}
+
+static vector<string> sample_text(size_t num_lines) {
+    vector<string> lines;
+    for(size_t i = 0; i < num_lines; ++i)
+        lines.push_back("line " + to_string(i) + " of the sample text");
+    return lines;
+}
+
+// one character typed or deleted somewhere in the first num_lines lines
+static Operation random_edit(std::mt19937& random, size_t num_lines) {
+    Position at(random() % num_lines, random() % 24);
+    if(random() % 4)
+        return Operation::insert(at, string(1, 'a' + random() % 26));
+    return Operation::erase(at, Position(at.line, at.col + 1));
+}
+
+// an append-heavy log, a line at a time at the end of an empty text
+static void bench_append(const string& name, TextModel& model, size_t ops) {
+    size_t before = heap_bytes;
+    model.load(vector<string>(1));
+    size_t text = 0;
+    auto start  = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        string entry = "log entry " + to_string(i) + '\n';
+        text += entry.size();
+        model.edit(Operation::insert(Position(model.size() - 1, 0), entry));
+    }
+    report(name, "append", ops, seconds_since(start), heap_bytes - before,
+           text);
+}
+
+// single characters typed and deleted all over a loaded text
+static void bench_edit(const string& name, TextModel& model, size_t ops) {
+    vector<string> lines = sample_text(100000);
+    size_t text          = 0;
+    for(const string& line : lines)
+        text += line.size() + 1;
+    size_t before = heap_bytes;
+    model.load(std::move(lines));
+    std::mt19937 random(1);
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < ops; ++i)
+        model.edit(random_edit(random, model.size()));
+    report(name, "edit", ops, seconds_since(start), heap_bytes - before,
+           text);
+}
+
+// The server transforms a client's ops past the ones applied since the
+// revision the client saw. Here every op was made lag ops behind.
+static void bench_merge_document(size_t ops) {
+    const size_t lag      = 16;
+    vector<string> lines  = sample_text(100000);
+    size_t text           = 0;
+    for(const string& line : lines)
+        text += line.size() + 1;
+    size_t before = heap_bytes;
+    Document doc;
+    doc.load(std::move(lines));
+    std::mt19937 random(1);
+    for(size_t i = 0; i < lag; ++i)
+        doc.edit(random_edit(random, doc.size()));
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        vector<Operation> batch(1, random_edit(random, doc.size()));
+        uint64_t revision = doc.snapshot()->get_revision();
+        doc.apply(batch, revision - lag, [](const vector<Operation>&) {});
+    }
+    report("document", "merge", ops, seconds_since(start),
+           heap_bytes - before, text);
+}
+
+// Two replicas edit apart, then each merges what the other did. The ops
+// arrive shuffled within a window, so some wait for the ones they follow.
+static void bench_merge_sequence(size_t ops) {
+    vector<string> lines = sample_text(100000);
+    size_t text          = 0;
+    for(const string& line : lines)
+        text += line.size() + 1;
+    size_t before = heap_bytes;
+    Sequence a(1), b(2);
+    a.load(vector<string>(lines));
+    b.load(std::move(lines));
+    std::mt19937 random(1);
+    vector<SequenceOp> from_a, from_b;
+    for(size_t i = 0; i < ops / 2; ++i) {
+        from_a.push_back(a.apply(random_edit(random, a.size())));
+        from_b.push_back(b.apply(random_edit(random, b.size())));
+    }
+    for(vector<SequenceOp>* sent : {&from_a, &from_b})
+        for(size_t i = 0; i < sent->size(); i += 64)
+            std::shuffle(sent->begin() + i,
+                         sent->begin() + std::min(i + 64, sent->size()),
+                         random);
+    vector<Operation> applied;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < ops / 2; ++i) {
+        applied.clear();
+        a.merge(from_b[i], applied);
+        b.merge(from_a[i], applied);
+    }
+    double seconds = seconds_since(start);
+    vector<SequenceOp>().swap(from_a);
+    vector<SequenceOp>().swap(from_b);
+    report("sequence", "merge", ops / 2 * 2, seconds, heap_bytes - before,
+           text);
+    if(a.text() != b.text() || a.num_waiting() || b.num_waiting())
+        cerr << "The replicas did not converge." << endl;
+}
+
+int main(int argc, char* argv[]) {
+    string model = argc > 1 ? argv[1] : "both";
+    size_t ops   = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+    if((model != "document" && model != "sequence" && model != "both") ||
+       !ops) {
+        cerr << "Usage: " << argv[0] << " [document|sequence|both] [ops]"
+             << endl;
+        return 1;
+    }
+    if(model != "sequence") {
+        {
+            Document doc;
+            bench_append("document", doc, ops);
+        }
+        {
+            Document doc;
+            bench_edit("document", doc, ops);
+        }
+        bench_merge_document(ops);
+    }
+    if(model != "document") {
+        {
+            Sequence seq;
+            bench_append("sequence", seq, ops);
+        }
+        {
+            Sequence seq;
+            bench_edit("sequence", seq, ops);
+        }
+        bench_merge_sequence(ops);
+    }
+    return 0;
+}
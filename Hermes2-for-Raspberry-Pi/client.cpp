@@ -5,12 +5,15 @@
 #include <unistd.h>
 #include <algorithm>
 #include <cctype>
-#include <condition_variable>
 #include <csignal>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <list>
 #include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <utility>
@@ -18,7 +21,11 @@
 
 #include "client.h"
 #include "editor.h"
+#include "inbox.h"
+#include "linecache.h"
+#include "operation.h"
 #include "socket.h"
+#include "syntax.h"
 #include "util.h"
 #include "window.h"
 
@@ -33,13 +40,38 @@ using std::lock;
 
 int max_row, max_col;
 volatile std::sig_atomic_t running = 0;
-vector<string> file_list;
-list<ClientLineEntry> file_contents;
-std::mutex file_list_mutex;
-std::mutex status_mutex;
-std::condition_variable status_cv;
+string browse_dir;  // directory shown in editor.dir, "" being the root
+Viewport file_contents;  // the rows of the open file in the window
+std::mutex file_list_mutex;  // guards browse_dir and editor.dir
+Inbox inbox;  // requests sent and not answered yet
 Socket server;  // contains socket, ip, port number, etc.
 Editor editor;  // for windows info, etc.
+// guards editor, file_contents and pending between the two threads
+std::mutex editor_mutex;
+OperationBuffer pending;      // local edits the server has not applied yet
+bool line_requested = false;  // whether a C_ADD_LINE_BACK is in flight
+LineCache line_cache;  // lines above and below the window
+// blocks asked for with C_FETCH_LINES and not in yet, as [first, last)
+std::deque<std::pair<size_t, size_t>> fetching;
+// how fast the window scrolls, which sets how far to read ahead
+uint64_t last_scroll = 0;
+size_t scroll_streak = 0;  // lines scrolled in a row the same way
+bool scrolled_down   = true;
+// commands that wait until the server has every local edit, undo and
+// redo as well as fetching another viewport, which drops pending
+vector<std::pair<int, string>> deferred;
+// in-document search: matches of the search numbered find_id stream in
+// from the server, in local line numbers, and move with every edit
+size_t find_id = 0;
+string find_query;
+vector<Position> matches;
+// the server's ops since the search started, the hits are at an earlier
+// revision and go through the ones after it
+vector<Operation> find_ops;
+size_t current_match = SIZE_MAX;  // the one jumped to last
+bool find_done       = true;
+bool jumping         = false;  // the cursor goes to jump_target
+Position jump_target;
 
 int main() {
     // --------------- init --------------------
@@ -47,6 +79,19 @@ int main() {
     raw();                 // enable raw mode so we can capture ctrl+c, etc.
     keypad(stdscr, true);  // to capture arrow key, etc.
     noecho();              // so that escape characters won't be printed
+    // a paste arrives between two markers instead of as typed keys
+    define_key("\033[200~", KEY_PASTE_BEGIN);
+    define_key("\033[201~", KEY_PASTE_END);
+    define_key("\033[1;3A", KEY_MOVE_UP);  // Alt + Up
+    define_key("\033[1;3B", KEY_MOVE_DOWN);
+    define_key("\033[1;2A", KEY_SR);  // Shift + Up
+    define_key("\033[1;2B", KEY_SF);
+    std::fputs("\033[?2004h", stdout);
+    std::fflush(stdout);
+    std::atexit([] {
+        std::fputs("\033[?2004l", stdout);
+        std::fflush(stdout);
+    });
     getmaxyx(stdscr, max_row, max_col);  // get max windows size
     start_color();                       // enable coloring
     init_colors();                       // add color configurations
@@ -61,6 +106,7 @@ int main() {
     // ---------- run editor ------------------
 
     // use multithread to handle message
+    running = S_DIR_MODE;
     std::thread handler_thread(message_handler);
     run_editor();
 
@@ -76,6 +122,11 @@ void init_colors() {
     init_pair(1, COLOR_WHITE, COLOR_BLACK);
     init_pair(2, COLOR_BLUE, COLOR_BLACK);
     init_pair(3, COLOR_WHITE, COLOR_RED);
+    // syntax highlighting, in the order of Syntax::pair()
+    int pair = Syntax::FIRST_PAIR;
+    for(short color : {COLOR_CYAN, COLOR_YELLOW, COLOR_GREEN, COLOR_MAGENTA,
+                       COLOR_RED})
+        init_pair(pair++, color, COLOR_BLACK);
 }
 
 
@@ -85,21 +136,6 @@ void message_handler() {
     string message;  // message received
     int command;     // command received
 
-    // getting file list before starting editor
-    server.send("init", C_GET_REMOTE_FILE_LIST);
-    if(server.receive(message, command) < 0) {
-        mvprintw(0, max_col / 2 - 10, "receive() fails.");
-        return;
-    }
-    size_t num_message = std::stoul(message);
-    file_list.reserve(num_message);
-    for(size_t i = 0; i < num_message; ++i) {
-        server.receive(message, command);
-        file_list.push_back(message);
-    }
-
-    running = 1;
-
     while(running && status) {
         status = server.receive(message, command);
         if(status <= 0) {
@@ -110,75 +146,744 @@ void message_handler() {
 
         switch(command) {
             case C_RESPONSE_FILE_INFO: {
-                num_message = std::stoul(message);
+                size_t num_message = std::stoul(message);
                 server.receive(message, command);
-                editor.file.set_num_file_lines(std::stoul(message));
-                for(int i = 0; i < num_message; ++i) {
+                size_t num_lines, first;
+                uint64_t revision;
+                int author;
+                std::istringstream(message) >> num_lines >> first >> revision >>
+                    author;
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                file_contents.reset(first, max_row - 2);
+                for(size_t i = 0; i < num_message; ++i) {
                     server.receive(message, command);
-                    file_contents.emplace_back(std::move(message), i);
+                    file_contents.push_back(std::move(message));
+                }
+                // anything still pending is dropped along with the old
+                // window
+                pending.reset(revision, author);
+                line_requested = false;
+                if(running != S_FILE_MODE) {
+                    // another file, a jump within the same one keeps what
+                    // is cached
+                    line_cache.clear();
+                    fetching.clear();
                 }
+                editor.file.set_num_file_lines(num_lines);
+                editor.file.set_file_content(&file_contents);
+                if(running == S_FILE_MODE)
+                    editor.file.refresh_file_content(-1);
+                if(jumping && jump_target.line >= first &&
+                   jump_target.line < first + num_message) {
+                    editor.file.set_pos(jump_target.line - first,
+                                        jump_target.col);
+                    server.send(to_string(editor.file.get_row()),
+                                C_SET_CURSOR_POS);
+                }
+                jumping = false;
                 running = S_FILE_MODE;
+                read_ahead(true);
+                inbox.complete(C_RESPONSE_FILE_INFO);
                 break;
             }
             case C_PUSH_LINE_BACK: {
-                file_contents.pop_front();
-                file_contents.emplace_back(std::move(message),
-                                           file_contents.back().linenum + 1);
-                running = S_FILE_MODE;
+                // the window scrolls down a line as each one comes in
+                size_t linenum;
+                string line;
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                inbox.complete(C_PUSH_LINE_BACK);
+                if(file_contents.empty())
+                    break;
+                size_t wanted = file_contents.bottom();
+                if(!parse_line(message, linenum, line) ||
+                   !pending.to_local(linenum, linenum) || linenum != wanted) {
+                    // the window moved in the meantime, ask again unless
+                    // another line is on the way
+                    if(!inbox.in_flight(C_PUSH_LINE_BACK))
+                        request_line(wanted, C_PUSH_LINE_BACK);
+                    break;
+                }
+                if(editor.file.missing_rows()) {
+                    file_contents.push_back(std::move(line));
+                    editor.file.refresh_file_content(file_contents.size() - 1);
+                } else {
+                    line_cache.put(file_contents.top(), file_contents.front());
+                    file_contents.pop_front();
+                    file_contents.push_back(std::move(line));
+                    editor.file.scroll_rows(1);
+                }
+                server.send(to_string(editor.file.get_row()), C_SET_CURSOR_POS);
                 break;
             }
             case C_ADD_LINE_BACK: {
-                file_contents.emplace_back(std::move(message),
-                                           file_contents.back().linenum + 1);
-                running = S_FILE_MODE;
+                size_t linenum;
+                string line;
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                line_requested = false;
+                if(parse_line(message, linenum, line) &&
+                   pending.to_local(linenum, linenum) &&
+                   editor.file.missing_rows() &&
+                   linenum == file_contents.bottom()) {
+                    file_contents.push_back(std::move(line));
+                    if(file_contents.size() == 1)
+                        editor.file.set_file_content(&file_contents);
+                    editor.file.refresh_file_content(file_contents.size() - 1);
+                }
+                request_missing_lines();
                 break;
             }
             case C_PUSH_LINE_FRONT: {
+                size_t linenum;
+                string line;
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                inbox.complete(C_PUSH_LINE_FRONT);
+                if(file_contents.empty() || !file_contents.top())
+                    break;
+                size_t wanted = file_contents.top() - 1;
+                if(!parse_line(message, linenum, line) ||
+                   !pending.to_local(linenum, linenum) || linenum != wanted) {
+                    if(!inbox.in_flight(C_PUSH_LINE_FRONT))
+                        request_line(wanted, C_PUSH_LINE_FRONT);
+                    break;
+                }
+                line_cache.put(file_contents.bottom() - 1,
+                               file_contents.back());
                 file_contents.pop_back();
-                file_contents.emplace_front(std::move(message),
-                                            file_contents.front().linenum - 1);
-                running = S_FILE_MODE;
+                file_contents.push_front(std::move(line));
+                editor.file.scroll_rows(-1);
+                server.send(to_string(editor.file.get_row()), C_SET_CURSOR_POS);
                 break;
             }
-            case C_UPDATE_LINE_CONTENT: {
-                size_t line_to_insert = std::stoul(message);
-                server.receive(message, command);
-                int row = 0;
-                for(auto& line : file_contents) {
-                    if(line.linenum == line_to_insert) {
-                        line.s = std::move(message);
-                        editor.file.refresh_file_content(line.s, row);
-                        break;
+            case C_APPLY_OPS: {
+                // a batch the server applied in one step, drawn as one
+                // frame
+                uint64_t base_revision;
+                vector<Operation> ops;
+                if(!decode_batch(message, base_revision, ops))
+                    break;
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                for(Operation& op : ops) {
+                    if(!find_done)
+                        find_ops.push_back(op);
+                    op = pending.receive(std::move(op));
+                    line_cache.apply(op);
+                    editor.file.apply(op);
+                    move_matches(op);
+                }
+                request_missing_lines();
+                break;
+            }
+            case C_ACK_OPS: {
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                uint64_t revision = std::stoull(message);
+                if(!find_done) {
+                    // the server applied the batch as it is now, one
+                    // revision per op
+                    const vector<Operation>& batch = pending.in_flight();
+                    for(size_t i = 0; i < batch.size(); ++i) {
+                        find_ops.push_back(batch[i]);
+                        find_ops.back().revision =
+                            revision - batch.size() + 1 + i;
                     }
-                    ++row;
                 }
+                pending.ack(revision);
+                send_ops();
+                request_missing_lines();
                 break;
             }
-            case C_INSERT_LINE: {
-                size_t line_to_insert = std::stoul(message);
-                server.receive(message, command);
-                editor.file.insert_line(message, line_to_insert);
+            case C_FETCH_LINES: {
+                std::istringstream in(message);
+                size_t first;
+                in >> first;
+                in.get();
+                vector<string> lines;
+                string line;
+                while(std::getline(in, line))
+                    lines.push_back(std::move(line));
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                inbox.complete(C_FETCH_LINES);
+                if(!fetching.empty())
+                    fetching.pop_front();
+                // the lines are at the revision the client is at, local
+                // edits not yet applied on the server aside
+                if(pending.idle())
+                    line_cache.put(first, std::move(lines));
+                else
+                    for(size_t i = 0; i < lines.size(); ++i) {
+                        size_t local;
+                        if(pending.to_local(first + i, local))
+                            line_cache.put(local, lines[i]);
+                    }
+                request_missing_lines();
                 break;
             }
-            case C_DELETE_LINE: {
-                int r, c;
-                getyx(static_cast<WINDOW*>(editor.file), r, c);
-                if(editor.file.delete_line(std::stoul(message)) == 1) {
-                    server.send(to_string(file_contents.back().linenum + 1),
-                                C_ADD_LINE_BACK);
-                    server.receive(message, command);
-                    file_contents.emplace_back(
-                        std::move(message), file_contents.back().linenum + 1);
-                    editor.file.refresh_file_content(-1);
-                    editor.file.set_pos(r - 1, c);
+            case C_GET_STATS: {
+                uint64_t unsaved, lag;
+                size_t queued, total, undo;
+                if(!(std::istringstream(message) >> unsaved >> lag >> queued >>
+                     total >> undo))
+                    break;
+                std::ostringstream status;
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                // how long edits take to reach the server and come back,
+                // which applying them locally hides
+                uint64_t round_trip = pending.get_round_trip() / 100000;
+                if(round_trip)
+                    status << "Round trip: " << round_trip / 10 << '.'
+                           << round_trip % 10 << " ms. ";
+                status << "Unsaved edits: " << unsaved;
+                if(unsaved)
+                    status << ", oldest " << lag / 1000 << '.'
+                           << lag % 1000 / 100 << "s ago";
+                status << ". Saves queued: " << queued << " (" << total
+                       << " in total). Undo: " << undo / 1024 << " KB";
+                editor.status.print_status(status.str());
+                break;
+            }
+            case C_BROWSE: {
+                std::lock_guard<std::mutex> guard(file_list_mutex);
+                if(set_listing(message) && running == S_DIR_MODE)
+                    editor.dir.print_filelist();
+                inbox.complete(C_BROWSE);
+                break;
+            }
+            case C_FILE_ADDED:
+            case C_FILE_REMOVED: {
+                // fetch the page again if the change is in its directory
+                string parent = message;
+                if(!parent.empty() && parent.back() == '/')
+                    parent.pop_back();
+                size_t slash = parent.rfind('/');
+                parent.erase(slash == string::npos ? 0 : slash + 1);
+                std::lock_guard<std::mutex> guard(file_list_mutex);
+                if(parent == browse_dir)
+                    request_page(editor.dir.get_first());
+                break;
+            }
+            case C_UNDO:
+            case C_REDO: {
+                // the edits themselves arrive as C_APPLY_OPS
+                if(message == "1")
+                    break;
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                editor.status.print_status(command == C_UNDO
+                                               ? "Nothing to undo."
+                                               : "Nothing to redo.");
+                break;
+            }
+            case C_FIND: {
+                std::istringstream in(message);
+                size_t id, last;
+                uint64_t revision;
+                in >> id >> revision >> last;
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                if(id != find_id || editor.file.isempty())
+                    break;  // for an earlier search or file
+                size_t line, col;
+                while(in >> line >> col) {
+                    // bring the hit up to the revision the client is at
+                    Position hit(line, col);
+                    bool erased = false;
+                    for(const Operation& op : find_ops) {
+                        if(op.revision <= revision)
+                            continue;
+                        erased |= op.type == Operation::ERASE &&
+                                  op.from <= hit && hit < op.to;
+                        hit = transform(hit, op);
+                    }
+                    if(!erased && pending.to_local(hit))
+                        matches.push_back(hit);
+                }
+                find_done = last;
+                if(find_done)
+                    find_ops.clear();
+                if(current_match == SIZE_MAX) {
+                    // start at the cursor like kilo, wrapping around once
+                    // every match is in
+                    Position cursor(editor.file.get_row(),
+                                    editor.file.get_col());
+                    auto iter = std::find_if(
+                        matches.begin(),
+                        matches.end(),
+                        [&cursor](const Position& p) { return cursor <= p; });
+                    if(iter != matches.end())
+                        jump_to_match(iter - matches.begin());
+                    else if(find_done && !matches.empty())
+                        jump_to_match(0);
+                } else
+                    print_match_status();
+                if(find_done && matches.empty()) {
+                    editor.status.print_status("No match for \"" +
+                                               find_query + "\".");
                 }
                 break;
             }
             case C_SAVE_FILE: {
-                running = S_FILE_MODE;  // wake up editor from waiting mode
+                // the save ran in the background, editing went on
+                std::lock_guard<std::mutex> guard(editor_mutex);
+                editor.status.print_status(message == "1"
+                                               ? "File saved."
+                                               : "Failed to save file.");
+                break;
             }
         }
+        // one frame for whatever the message changed
+        std::lock_guard<std::mutex> guard(editor_mutex);
+        editor.render();
     }
+    inbox.close();
+}
+
+void send_ops() {
+    if(pending.ready()) {
+        uint64_t base_revision = pending.get_revision();
+        server.send(encode_batch(base_revision, pending.take_batch()),
+                    C_APPLY_OPS);
+    }
+    if(!pending.idle())
+        return;
+    for(const auto& command : deferred) {
+        if(command.first == C_REQUEST_VIEWPORT)
+            inbox.open(C_RESPONSE_FILE_INFO);
+        server.send(command.second, command.first);
+    }
+    deferred.clear();
+}
+
+void find_in_file(const string& query) {
+    ++find_id;
+    find_query = query;
+    matches.clear();
+    find_ops.clear();
+    current_match = SIZE_MAX;
+    find_done     = false;
+    server.send(to_string(find_id) + ' ' + query, C_FIND);
+    editor.status.print_status("Searching for \"" + query + "\"...");
+}
+
+void jump_to_match(size_t i) {
+    current_match         = i;
+    const Position& match = matches[i];
+    print_match_status();
+    size_t top = editor.file.get_top();
+    if(match.line >= top && match.line < file_contents.bottom()) {
+        editor.file.set_pos(match.line - top, match.col);
+        server.send(to_string(editor.file.get_row()), C_SET_CURSOR_POS);
+        return;
+    }
+    // fetch only the rows around it, once the server has every local edit
+    size_t rows  = max_row - 2;
+    size_t first = match.line > rows / 2 ? match.line - rows / 2 : 0;
+    jumping      = true;
+    jump_target  = match;
+    deferred.emplace_back(C_REQUEST_VIEWPORT,
+                          to_string(first) + ' ' + to_string(rows));
+    send_ops();
+}
+
+void move_matches(const Operation& op) {
+    if(matches.empty() || op.isnoop())
+        return;
+    size_t kept = 0, current = current_match;
+    for(size_t i = 0; i < matches.size(); ++i) {
+        const Position& match = matches[i];
+        if(op.type == Operation::ERASE && op.from <= match && match < op.to) {
+            if(current_match != SIZE_MAX && i < current_match)
+                --current;
+            continue;
+        }
+        matches[kept++] = transform(match, op);
+    }
+    matches.resize(kept);
+    if(jumping)
+        jump_target = transform(jump_target, op);
+    if(current_match != SIZE_MAX)
+        current_match = matches.empty() ? SIZE_MAX
+                                        : std::min(current, kept - 1);
+}
+
+void print_match_status() {
+    if(current_match == SIZE_MAX)
+        return;
+    editor.status.print_status(
+        "Match " + to_string(current_match + 1) + " of " +
+        to_string(matches.size()) + (find_done ? "" : "+") +
+        ". Press Ctrl+N or Ctrl+P for the next or previous one.");
+}
+
+bool read_query(const string& prompt, string& query) {
+    query.clear();
+    int c = 0;
+    while(true) {
+        editor_mutex.lock();
+        editor.prompting = true;
+        editor.status.print_status(prompt + query);
+        editor.render();
+        editor_mutex.unlock();
+        c = wgetch(editor.status);
+        if(std::isprint(c))
+            query.push_back(c);
+        else if(c == KEY_BACKSPACE || c == KEY_DC || c == KEY_DELETE ||
+                c == '\b') {
+            if(!query.empty())
+                query.pop_back();
+        } else if(c == KEY_ENTER || c == '\n' || c == KEY_ESC ||
+                  c == KEY_CTRL_Q)
+            break;
+    }
+    std::lock_guard<std::mutex> guard(editor_mutex);
+    editor.prompting = false;
+    return (c == KEY_ENTER || c == '\n') && !query.empty();
+}
+
+void request_missing_lines() {
+    if(line_requested || !editor.file.missing_rows())
+        return;
+    // rows moving up into the window may be cached already
+    string line;
+    while(!file_contents.empty() && editor.file.missing_rows() &&
+          line_cache.get(file_contents.bottom(), line)) {
+        file_contents.push_back(std::move(line));
+        editor.file.refresh_file_content(file_contents.size() - 1);
+    }
+    size_t missing = editor.file.missing_rows();
+    if(!missing)
+        return;
+    size_t next = file_contents.bottom();
+    if(missing > 1) {
+        // a window grown taller, or rows an edit took away, come in one
+        // round trip
+        bool on_the_way = std::any_of(
+            fetching.begin(),
+            fetching.end(),
+            [next](const std::pair<size_t, size_t>& block) {
+                return block.first <= next && next < block.second;
+            });
+        if(!on_the_way)
+            fetch_block(next, next + missing);
+        return;
+    }
+    line_requested = true;
+    server.send(to_string(pending.to_server(next)), C_ADD_LINE_BACK);
+}
+
+void request_line(size_t linenum, int command) {
+    inbox.open(command);
+    server.send(to_string(pending.to_server(linenum)), command);
+}
+
+bool scroll_from_cache(bool down) {
+    string line;
+    if(down) {
+        if(inbox.in_flight(C_PUSH_LINE_BACK) ||
+           !line_cache.get(file_contents.bottom(), line))
+            return false;
+        line_cache.put(file_contents.top(), file_contents.front());
+        file_contents.pop_front();
+        file_contents.push_back(std::move(line));
+        editor.file.scroll_rows(1);
+    } else {
+        if(inbox.in_flight(C_PUSH_LINE_FRONT) || !file_contents.top() ||
+           !line_cache.get(file_contents.top() - 1, line))
+            return false;
+        line_cache.put(file_contents.bottom() - 1, file_contents.back());
+        file_contents.pop_back();
+        file_contents.push_front(std::move(line));
+        editor.file.scroll_rows(-1);
+    }
+    server.send(to_string(editor.file.get_row()), C_SET_CURSOR_POS);
+    return true;
+}
+
+void read_ahead(bool down) {
+    // a key held down repeats every 30ms or so, each line scrolled in a
+    // row the same way reads further ahead, up to 4 blocks
+    uint64_t now = get_timestamp();
+    if(down == scrolled_down && now - last_scroll < 250000000)
+        ++scroll_streak;
+    else
+        scroll_streak = 0;
+    scrolled_down = down;
+    last_scroll   = now;
+    size_t ahead  = LineCache::BLOCK_LINES *
+                   std::min<size_t>(1 + scroll_streak / 16, 4);
+
+    size_t num_lines = editor.file.get_num_file_lines();
+    size_t from, to;
+    if(down) {
+        from = file_contents.bottom();
+        to   = std::min(num_lines, from + ahead);
+    } else {
+        to   = std::min(file_contents.top(), num_lines);
+        from = to > ahead ? to - ahead : 0;
+    }
+    while(from < to && fetching.size() < 4) {
+        size_t line = line_cache.missing(from, to, down);
+        if(line == to)
+            return;
+        // skip past lines on the way already
+        auto on_the_way = std::find_if(
+            fetching.begin(),
+            fetching.end(),
+            [line](const std::pair<size_t, size_t>& block) {
+                return block.first <= line && line < block.second;
+            });
+        if(on_the_way != fetching.end()) {
+            if(down)
+                from = on_the_way->second;
+            else
+                to = on_the_way->first;
+            continue;
+        }
+        size_t first, last;
+        if(down) {
+            first = line;
+            last  = std::min(num_lines, line + LineCache::BLOCK_LINES);
+            from  = last;
+        } else {
+            last  = line + 1;
+            first = last > LineCache::BLOCK_LINES
+                        ? last - LineCache::BLOCK_LINES
+                        : 0;
+            to    = first;
+        }
+        fetch_block(first, last);
+    }
+}
+
+void fetch_block(size_t first, size_t last) {
+    fetching.emplace_back(first, last);
+    inbox.open(C_FETCH_LINES);
+    server.send(to_string(pending.to_server(first)) + ' ' +
+                    to_string(last - first),
+                C_FETCH_LINES);
+}
+
+void resize_editor() {
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    if(rows < 3 || (rows == max_row && cols == max_col))
+        return;
+    std::lock_guard<std::mutex> list_guard(file_list_mutex);
+    std::lock_guard<std::mutex> guard(editor_mutex);
+    max_row       = rows;
+    max_col       = cols;
+    size_t height = max_row - 2;
+    // rows that no longer fit go to the cache, from the bottom unless the
+    // cursor is on them
+    size_t scrolled = 0;
+    if(running == S_FILE_MODE && !file_contents.empty()) {
+        size_t row = editor.file.get_row() - file_contents.top();
+        for(; row >= height + scrolled; ++scrolled) {
+            line_cache.put(file_contents.top(), file_contents.front());
+            file_contents.pop_front();
+        }
+        while(file_contents.size() > height) {
+            line_cache.put(file_contents.bottom() - 1, file_contents.back());
+            file_contents.pop_back();
+        }
+    }
+    editor.resize(max_row, max_col, scrolled);
+    if(running == S_DIR_MODE) {
+        // pages are as tall as the window
+        size_t first = editor.dir.get_selection();
+        first -= first % height;
+        editor.dir.print_filelist();
+        request_page(first);
+    } else if(running == S_FILE_MODE) {
+        // the server tracks the window by its height, to move it with the
+        // cursor and to send it again if this client falls out of sync;
+        // only the rows it gained are fetched
+        server.send(to_string(height), C_RESIZE_VIEWPORT);
+        server.send(to_string(editor.file.get_row()), C_SET_CURSOR_POS);
+        request_missing_lines();
+    }
+    editor.render();
+}
+
+void push_op(Operation op, bool send) {
+    line_cache.apply(op);
+    move_matches(op);
+    pending.push(std::move(op));
+    if(send)
+        send_ops();
+}
+
+bool get_line(size_t line, string& text) {
+    if(line >= file_contents.top() && line < file_contents.bottom()) {
+        text = file_contents[line - file_contents.top()];
+        return true;
+    }
+    if(line_cache.get(line, text))
+        return true;
+    if(fetching.empty())
+        fetch_block(line, line + 1);
+    return false;
+}
+
+void move_lines(bool down) {
+    size_t line = editor.file.get_row();
+    size_t col  = editor.file.get_col();
+    size_t num_lines = editor.file.get_num_file_lines();
+    size_t first, last;
+    editor.file.get_selection(first, last);
+    if(down ? last >= num_lines : !first)
+        return;
+    bool marked = editor.file.has_mark();
+    size_t mark = line == first ? last - 1 : first;  // the other end
+    // the cursor moves a line with them, scroll onto that line if it is
+    // cached, or have it fetched for the next try
+    if(down && line + 1 == file_contents.bottom()) {
+        if(!scroll_from_cache(true)) {
+            read_ahead(true);
+            return;
+        }
+        editor.file.set_pos(line - file_contents.top(), col);
+    } else if(!down && line == file_contents.top()) {
+        if(!scroll_from_cache(false)) {
+            read_ahead(false);
+            return;
+        }
+        editor.file.set_pos(line - file_contents.top(), col);
+    }
+    // the lines stay and the one next to them goes to their other side,
+    // so a single line is rewritten however many lines move; erase and
+    // insert go as one batch so no other client sees one without the
+    // other
+    size_t other = down ? last : first - 1;
+    string text, end;  // end is the last selected line, if it is needed
+    if(!get_line(other, text))
+        return;
+    Operation erase, insert;
+    if(other + 1 < num_lines) {
+        erase = Operation::erase(Position(other, 0), Position(other + 1, 0));
+        if(down)
+            insert = Operation::insert(Position(first, 0), text + '\n');
+        else if(last < num_lines)
+            insert = Operation::insert(Position(last - 1, 0), text + '\n');
+        else {
+            // after the last line of the file, which has no newline
+            if(!get_line(last - 1, end))
+                return;
+            insert = Operation::insert(Position(last - 2, end.size()),
+                                       '\n' + text);
+        }
+    } else {
+        // the last line of the file goes up, with the newline before it
+        if(!get_line(last - 1, end))
+            return;
+        erase  = Operation::erase(Position(last - 1, end.size()),
+                                 Position(other, text.size()));
+        insert = Operation::insert(Position(first, 0), text + '\n');
+    }
+    editor.file.apply(erase, true);
+    editor.file.apply(insert, true);
+    push_op(std::move(erase), false);
+    push_op(std::move(insert));
+    line = down ? line + 1 : line - 1;
+    editor.file.set_pos(line - file_contents.top(), col);
+    if(marked)
+        editor.file.set_mark(down ? mark + 1 : mark - 1);
+    server.send(to_string(editor.file.get_row()), C_SET_CURSOR_POS);
+}
+
+string read_paste(WINDOW* win) {
+    string text;
+    for(int c; (c = wgetch(win)) != KEY_PASTE_END && c != ERR;) {
+        if(c == '\r' || c == KEY_ENTER)
+            c = '\n';
+        if(c == '\n' || c == '\t' || std::isprint(c))
+            text.push_back(c);
+    }
+    return text;
+}
+
+void paste(const string& text) {
+    Position at(editor.file.get_row(), editor.file.get_col());
+    Operation op = Operation::insert(at, text);
+    size_t first, last, count;
+    op.line_effect(first, last, count);
+    // the rows as they were, and the lines the op puts in place of
+    // [first, last) of them
+    size_t top = file_contents.top();
+    vector<string> rows;
+    for(size_t row = 0; row < file_contents.size(); ++row)
+        rows.push_back(file_contents[row]);
+    vector<string> lines = op.apply(vector<string>(
+        rows.begin() + (first - top), rows.begin() + (last - top)));
+    editor.file.apply(op, true);
+    push_op(op);
+
+    Position end  = transform(at, op);
+    size_t height = max_row - 2;
+    if(end.line >= top + height) {
+        // the window follows the cursor to the end of the paste, the
+        // rows that leave it go to the cache
+        size_t new_top = end.line + 1 - height;
+        for(size_t line = top; line < std::min(new_top, first); ++line)
+            line_cache.put(line, rows[line - top]);
+        file_contents.reset(new_top, height);
+        for(size_t line = new_top; line <= end.line; ++line) {
+            if(line < first)
+                file_contents.push_back(std::move(rows[line - top]));
+            else if(line < first + count)
+                file_contents.push_back(std::move(lines[line - first]));
+            else
+                file_contents.push_back(
+                    std::move(rows[line - count + last - first - top]));
+        }
+        // so do the rows that were below the paste point
+        line_cache.put(first + count,
+                       vector<string>(rows.begin() + (last - top),
+                                      rows.end()));
+        editor.file.set_file_content(
+            &file_contents, end.line - new_top, end.col);
+        editor.file.refresh_file_content(-1);
+    }
+    server.send(to_string(editor.file.get_row()), C_SET_CURSOR_POS);
+}
+
+bool parse_line(const string& message, size_t& linenum, string& line) {
+    size_t space = message.find(' ');
+    if(space == string::npos || !space)
+        return false;
+    linenum = std::stoul(message.substr(0, space));
+    line    = message.substr(space + 1);
+    return true;
+}
+
+uint64_t request_page(size_t first) {
+    uint64_t id = inbox.open(C_BROWSE);
+    server.send(to_string(first) + ' ' + to_string(max_row - 2) + ' ' +
+                    browse_dir,
+                C_BROWSE);
+    return id;
+}
+
+bool set_listing(const string& message) {
+    std::istringstream in(message);
+    size_t total = 0, first = 0;
+    in >> total >> first;
+    in.get();
+    string dir;
+    std::getline(in, dir);
+    if(dir != browse_dir)
+        return false;  // answers a request made before leaving it
+    vector<string> entries;
+    string entry;
+    while(std::getline(in, entry))
+        entries.push_back(std::move(entry));
+    editor.dir.set_page(std::move(entries), first, total);
+    return true;
+}
+
+void open_directory(const string& dir) {
+    browse_dir = dir;
+    editor.dir.select(0);
+    editor.dir.set_page({}, 0, 0);
+    editor.dir.print_filelist();
+    editor.status.print_filename("~/" + browse_dir);
+    request_page(0);
 }
 
 void run_editor() {
@@ -186,8 +891,13 @@ void run_editor() {
     getyx(stdscr, y, x);
     mvprintw(y + 1, max_col / 2 - 11, "Retrieving file list...");
     getyx(stdscr, y, x);
-    while(!running)  // wait until file list is ready
-        ;
+    // getting the first page of files before starting editor, the rest
+    // is fetched as the user scrolls
+    file_list_mutex.lock();
+    uint64_t listing = request_page(0);
+    file_list_mutex.unlock();
+    if(!inbox.wait(listing))
+        return;  // the server went away
 
     // init editor
     editor.init(max_row, max_col);
@@ -196,54 +906,132 @@ void run_editor() {
     editor.status.print_filename("~");  // denotes that we haven't select file
     editor.status.print_status(
         "Press Enter to select a file. Press Ctrl+Q to quit.");
-    editor.dir.print_filelist(file_list);
+    file_list_mutex.lock();
+    editor.dir.print_filelist();
+    editor_mutex.lock();
+    editor.render();
+    editor_mutex.unlock();
+    file_list_mutex.unlock();
     int c;
     while(running) {
         while(running == S_DIR_MODE) {  // directory mode
             c = wgetch(editor.dir);
+            if(c == KEY_RESIZE) {
+                resize_editor();
+                continue;
+            }
+            // pages arrive on the other thread
+            std::unique_lock<std::mutex> lock(file_list_mutex);
+            std::lock_guard<std::mutex> guard(editor_mutex);
+            size_t wanted;
             switch(c) {
                 case KEY_UP:
-                    editor.dir.scroll_up(file_list);
+                    if(!editor.dir.scroll_up(wanted))
+                        request_page(wanted);
                     break;
                 case KEY_DOWN:
-                    editor.dir.scroll_down(file_list);
+                    if(!editor.dir.scroll_down(wanted))
+                        request_page(wanted);
+                    break;
+                case KEY_LEFT:
+                case KEY_BACKSPACE:
+                case KEY_DELETE:
+                case '\b': {
+                    if(browse_dir.empty())
+                        break;
+                    // up to the parent directory
+                    string parent = browse_dir;
+                    parent.pop_back();
+                    size_t slash = parent.rfind('/');
+                    parent.erase(slash == string::npos ? 0 : slash + 1);
+                    open_directory(parent);
                     break;
+                }
                 case KEY_CTRL_Q:
                     endwin();
                     running = 0;
                     std::exit(0);
                 case KEY_ENTER:
-                case '\n':
-                    editor.status.print_filename(
-                        file_list[editor.dir.get_selection()]);
+                case '\n': {
+                    string entry = editor.dir.get_selected();
+                    if(entry.empty())
+                        break;  // its page is still on the way
+                    if(entry.back() == '/') {
+                        open_directory(browse_dir + entry);
+                        break;
+                    }
+                    editor.status.print_filename(browse_dir + entry);
+                    editor.file.set_syntax(entry);
                     editor.switch_mode();
                     running = S_WAITING_MODE;
                     break;
+                }
             }
+            editor.render();
         }
+        editor_mutex.lock();
         editor.status.print_status("Retrieving file contents...");
+        editor.render();
+        ++find_id;  // matches of the last file are of no use
+        matches.clear();
+        current_match = SIZE_MAX;
+        jumping       = false;
+        editor_mutex.unlock();
         // send file name and number of rows
+        uint64_t contents = inbox.open(C_RESPONSE_FILE_INFO);
         server.send(editor.status.get_filename(), C_OPEN_FILE_REQUEST);
         server.send(to_string(max_row - 2));
-        while(running == S_WAITING_MODE)  // waiting for file content
-            ;
+        if(!inbox.wait(contents))
+            break;  // the server went away
+        editor_mutex.lock();
         editor.status.print_status(
             "Welcome to Hermes. Press Ctrl+O to switch to editing mode.");
-        editor.file.set_file_content(&file_contents);
         editor.file.refresh_file_content(-1);
+        editor.render();
+        editor_mutex.unlock();
         // int y = 0;
         // for(const string& line : file_contents)
         //     editor.file.printline(line, y++);
 
         while(running == S_FILE_MODE) {  // file mode
             c = wgetch(editor.file);
+            if(c == KEY_RESIZE) {
+                resize_editor();
+                continue;
+            }
+            string pasted;
+            if(c == KEY_PASTE_BEGIN)
+                pasted = read_paste(editor.file);
+            // edits are applied locally right away and queued as ops
+            std::unique_lock<std::mutex> lock(editor_mutex);
+            if(editor.file.isempty())
+                continue;  // rows are still being fetched
+            // a jump replaces the window and drops whatever the server has
+            // not acknowledged, so keys wait for its rows like they do for
+            // the rows of a file
+            if(jumping && c != KEY_CTRL_Q)
+                continue;
+            // Shift+Up and Shift+Down mark the lines Alt+Up and Alt+Down
+            // move, any other key lets go of them
+            if(c == KEY_SR || c == KEY_SF) {
+                if(editor.file.isediting && !editor.file.has_mark())
+                    editor.file.set_mark(editor.file.get_row());
+                c = c == KEY_SR ? KEY_UP : KEY_DOWN;
+            } else if(c != KEY_MOVE_UP && c != KEY_MOVE_DOWN)
+                editor.file.clear_mark();
+            if(c == KEY_PASTE_BEGIN) {
+                if(editor.file.isediting && !pasted.empty())
+                    paste(pasted);
+                editor.render();
+                continue;
+            }
             if(std::isprint(c)) {
                 if(!editor.file.isediting)
                     continue;
-                editor.file.insertchar(c);
-                // server.send(to_string(editor.file.get_row()),
-                //             C_UPDATE_LINE_CONTENT);
-                server.send(editor.file.get_currline(), C_UPDATE_LINE_CONTENT);
+                Position at(editor.file.get_row(), editor.file.get_col());
+                if(editor.file.insertchar(c))
+                    push_op(Operation::insert(at, string(1, c)));
+                editor.render();
 
                 // skip the following switch statement
                 continue;
@@ -254,32 +1042,41 @@ void run_editor() {
                     running = 0;
                     std::exit(0);
                 case KEY_UP: {
-                    if(editor.file.scroll_up() == -1) {
-                        // retrieve previous line from server
-                        server.send(
-                            to_string(file_contents.front().linenum - 1),
-                            C_PUSH_LINE_FRONT);
-                        running = S_WAITING_MODE;
-                        while(running == S_WAITING_MODE)
-                            ;
-                        editor.file.refresh_file_content(-1);
+                    int moved = editor.file.scroll_up();
+                    if(moved == 1) {
+                        server.send(to_string(editor.file.get_row()),
+                                    C_SET_CURSOR_POS);
+                        break;
                     }
-                    server.send(to_string(editor.file.get_row()),
-                                C_SET_CURSOR_POS);
+                    // retrieve previous line from server without waiting,
+                    // the window scrolls once it is in; a key held down
+                    // asks for the lines before the ones on the way
+                    if(moved != -1)
+                        break;
+                    size_t ahead = inbox.in_flight(C_PUSH_LINE_FRONT);
+                    if(!scroll_from_cache(false) &&
+                       ahead < file_contents.top())
+                        request_line(file_contents.top() - 1 - ahead,
+                                     C_PUSH_LINE_FRONT);
+                    read_ahead(false);
                     break;
                 }
                 case KEY_DOWN: {
-                    if(editor.file.scroll_down() == -1) {
-                        // retrieve the line after from server
-                        server.send(to_string(file_contents.back().linenum + 1),
-                                    C_PUSH_LINE_BACK);
-                        running = S_WAITING_MODE;
-                        while(running == S_WAITING_MODE)
-                            ;
-                        editor.file.refresh_file_content(-1);
+                    int moved = editor.file.scroll_down();
+                    if(moved == 1) {
+                        server.send(to_string(editor.file.get_row()),
+                                    C_SET_CURSOR_POS);
+                        break;
                     }
-                    server.send(to_string(editor.file.get_row()),
-                                C_SET_CURSOR_POS);
+                    // retrieve the line after from server the same way
+                    if(moved != -1)
+                        break;
+                    size_t ahead = inbox.in_flight(C_PUSH_LINE_BACK);
+                    size_t next  = file_contents.bottom() + ahead;
+                    if(!scroll_from_cache(true) &&
+                       next < editor.file.get_num_file_lines())
+                        request_line(next, C_PUSH_LINE_BACK);
+                    read_ahead(true);
                     break;
                 }
                 case KEY_LEFT:
@@ -288,58 +1085,90 @@ void run_editor() {
                 case KEY_RIGHT:
                     editor.file.scroll_right();
                     break;
+                case KEY_CTRL_G: {
+                    // how far the file on the server is from being saved
+                    server.send("", C_GET_STATS);
+                    break;
+                }
+                case KEY_CTRL_Z:
+                case KEY_CTRL_Y: {
+                    if(!editor.file.isediting)
+                        break;
+                    deferred.emplace_back(c == KEY_CTRL_Z ? C_UNDO : C_REDO,
+                                          "");
+                    send_ops();
+                    break;
+                }
+                case KEY_CTRL_F: {
+                    // the client only holds the window, so the server
+                    // searches the whole document
+                    string query;
+                    lock.unlock();
+                    bool ok = read_query("Search: ", query);
+                    lock.lock();
+                    if(ok)
+                        find_in_file(query);
+                    else
+                        editor.status.print_status("");
+                    break;
+                }
+                case KEY_CTRL_N:
+                case KEY_CTRL_P: {
+                    if(matches.empty())
+                        break;
+                    size_t n = matches.size();
+                    if(current_match == SIZE_MAX)
+                        jump_to_match(0);
+                    else if(c == KEY_CTRL_N)
+                        jump_to_match((current_match + 1) % n);
+                    else
+                        jump_to_match((current_match + n - 1) % n);
+                    break;
+                }
                 case KEY_CTRL_S:
                 case KEY_SAVE: {
-                    int curry, currx;
-                    getyx(static_cast<WINDOW*>(editor.file), curry, currx);
                     // ask the server to dump what is in memory
                     // into a file
                     // No need to be in editing mode
+                    // the server saves in the background and answers
+                    // with C_SAVE_FILE, so there is no need to wait
                     server.send("", C_SAVE_FILE);
                     editor.status.print_status("Saving file on server...");
-                    // since the thread for current client won't be
-                    // ready to receive new message until the server
-                    // is done saving file, we'll wait
-                    running = S_WAITING_MODE;
-                    while(running == S_WAITING_MODE)
-                        ;
-                    if(editor.file.isediting)
-                        editor.status.print_status(
-                            "Press Ctrl+O to switch to browsing mode. Press "
-                            "Ctrl+Q to quit.");
-                    else
-                        editor.status.print_status(
-                            "Press Ctrl+O to switch to editing mode. Press "
-                            "Ctrl+Q to quit.");
-                    wmove(editor.file, curry, currx);
                     break;
                 }
                 case '\n':
                 case KEY_ENTER: {
                     if(!editor.file.isediting)
                         break;
-                    // insert a new line
-                    editor.file.add_line();
-                    // first update the content of the original line
-                    // then insert the new line
-                    server.send(editor.file.get_prevline(),
-                                C_UPDATE_LINE_CONTENT);
-                    server.send(editor.file.get_currline(), C_INSERT_LINE);
-
+                    // insert a new line by splitting the current one
+                    Position at(editor.file.get_row(), editor.file.get_col());
+                    if(!editor.file.add_line())
+                        break;
+                    push_op(Operation::insert(at, "\n"));
+                    // on the last row the window scrolled a line
+                    server.send(to_string(editor.file.get_row()),
+                                C_SET_CURSOR_POS);
                     break;
                 }
                 case KEY_BACKSPACE:
                 case KEY_DC:
                 case KEY_DELETE:
-                case '\b':
+                case '\b': {
                     if(!editor.file.isediting)
                         break;
-                    editor.file.delchar();
-                    // server.send(to_string(editor.file.get_row()),
-                    //             C_UPDATE_LINE_CONTENT);
-                    server.send(editor.file.get_currline(),
-                                C_UPDATE_LINE_CONTENT);
+                    // at the start of a line it joins the line before
+                    Position to(editor.file.get_row(), editor.file.get_col());
+                    Position from =
+                        to.col ? Position(to.line, to.col - 1)
+                               : Position(to.line - 1,
+                                          editor.file.get_prevline().size());
+                    if(!editor.file.delchar())
+                        break;
+                    push_op(Operation::erase(from, to));
+                    if(!to.col)
+                        request_missing_lines();
                     break;
+                }
                 case KEY_CTRL_O: {
                     editor.file.isediting = !editor.file.isediting;
                     if(editor.file.isediting) {
@@ -363,33 +1192,39 @@ void run_editor() {
                     }
                     break;
                 }
+                case KEY_MOVE_UP:
+                case KEY_MOVE_DOWN:
+                    if(editor.file.isediting)
+                        move_lines(c == KEY_MOVE_DOWN);
+                    break;
                 case KEY_CTRL_X: {
                     if(!editor.file.isediting)
                         break;
-                    int curry, currx;
-                    getyx(static_cast<WINDOW*>(editor.file), curry, currx);
-                    ssize_t retval = editor.file.del_line();
-                    if(retval == -1) {
-                        editor.file.set_pos(curry - 1, 0);
+                    // take the whole line out, or join the last line of
+                    // the file onto the one before it if that is in the
+                    // window
+                    size_t row = editor.file.get_row();
+                    Operation op;
+                    if(row + 1 < editor.file.get_num_file_lines())
+                        op = Operation::erase(Position(row, 0),
+                                              Position(row + 1, 0));
+                    else if(row > editor.file.get_top())
+                        op = Operation::erase(
+                            Position(row - 1, editor.file.get_prevline().size()),
+                            Position(row, editor.file.get_currline().size()));
+                    else
                         break;
-                    }
-                    server.send(to_string(editor.file.get_row() + 1),
-                                C_DELETE_LINE);
-                    if(retval == 1) {
-
-                        server.send(to_string(file_contents.back().linenum + 1),
-                                    C_ADD_LINE_BACK);
-                        running = S_WAITING_MODE;
-                        while(running == S_WAITING_MODE)
-                            ;
-                    }
-                    editor.file.refresh_file_content(-1);
-                    editor.file.set_pos(curry - 1, 0);
+                    if(editor.file.del_line() == -1)
+                        break;
+                    push_op(std::move(op));
+                    // a row from below moves up into the window
+                    request_missing_lines();
                     server.send(to_string(editor.file.get_row()),
                                 C_SET_CURSOR_POS);
                     break;
                 }
             }
+            editor.render();
         }
     }
 }
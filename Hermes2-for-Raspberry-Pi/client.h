@@ -4,18 +4,34 @@
 #include <ncurses.h>
 #include <string>
 #include <vector>
+#include "operation.h"
 #include "util.h"
 
 enum CTRL_KEY_TYPE {
     KEY_CTRL_C = 3,
+    KEY_CTRL_F = 6,
     KEY_CTRL_G = 7,
+    KEY_CTRL_N = 14,
     KEY_CTRL_O = 15,
+    KEY_CTRL_P = 16,
     KEY_CTRL_Q = 17,
     KEY_CTRL_S = 19,
     KEY_CTRL_X = 24,
+    KEY_CTRL_Y = 25,
+    KEY_CTRL_Z = 26,
+    KEY_ESC    = 27,
     KEY_DELETE = 127,
 };
 
+// what define_key() turns the markers of a bracketed paste and keys
+// terminfo has no name for into
+enum DEFINED_KEY_TYPE {
+    KEY_PASTE_BEGIN = KEY_MAX + 1,
+    KEY_PASTE_END,
+    KEY_MOVE_UP,
+    KEY_MOVE_DOWN,
+};
+
 using std::string;
 using std::vector;
 
@@ -38,6 +54,58 @@ void print_welcome_screen();
 void init_colors();
 bool wgetline(WINDOW* w, string& s, size_t n = 0);
 void message_handler();  // TODO
+// send buffered edits unless a batch is in flight, then deferred commands
+void send_ops();
+// with editor_mutex held: fill the rows below the last one, from the cache
+// or the server
+void request_missing_lines();
+// with editor_mutex held: start a server search of the open file
+void find_in_file(const string& query);
+// with editor_mutex held: move the cursor onto matches[i], fetching the
+// rows around it if it is outside the window
+void jump_to_match(size_t i);
+// with editor_mutex held: move matches and jump_target across op, an op on
+// the local copy; the matches it erases are dropped
+void move_matches(const Operation& op);
+void print_match_status();
+// read a line typed after prompt on the status bar, false if cancelled
+bool read_query(const string& prompt, string& query);
+// ask for the page of browse_dir starting at first, file_list_mutex held;
+// returns the id of the request in inbox
+uint64_t request_page(size_t first);
+// with editor_mutex held: ask for line with command, scrolling to it once
+// it comes in
+void request_line(size_t linenum, int command);
+// with editor_mutex held: scroll the window a line from line_cache, false
+// if the line is not there or lines from the server are still on the way
+bool scroll_from_cache(bool down);
+// with editor_mutex held: fetch the blocks past the edge of the window the
+// cursor is heading for, further ahead the faster it goes
+void read_ahead(bool down);
+// with editor_mutex held: ask for lines [first, last) to go in line_cache
+void fetch_block(size_t first, size_t last);
+// fit the editor to the terminal after a KEY_RESIZE, taking both locks
+void resize_editor();
+// with editor_mutex held: queue a local edit and send it, unless more ops
+// of the same edit follow and have to go in the same batch
+void push_op(Operation op, bool send = true);
+// with editor_mutex held: text of line from the window or line_cache,
+// otherwise have it fetched and return false
+bool get_line(size_t line, string& text);
+// with editor_mutex held: move the selected lines one line down, or up,
+// the cursor and the mark going with them
+void move_lines(bool down);
+// the keys of a paste up to its end marker, as the text they make
+string read_paste(WINDOW* win);
+// with editor_mutex held: insert text at the cursor as a single op and
+// move the cursor behind it
+void paste(const string& text);
+// take a C_BROWSE answer, false if it is for another directory
+bool set_listing(const string& message);
+// show the first page of dir
+void open_directory(const string& dir);
+// split a "linenum content" message
+bool parse_line(const string& message, size_t& linenum, string& line);
 void run_editor();       // TODO
 void segfault_handler(int sig);
 
@@ -0,0 +1,725 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+using std::shared_ptr;
+
+const size_t Document::BLOCK_SIZE;
+const size_t Document::HISTORY_SIZE;
+
+// split lines into evenly sized blocks of at most BLOCK_SIZE lines
+static void chunk_lines(vector<string>& lines,
+                        vector<shared_ptr<const Document::Block>>& out) {
+    size_t n = lines.size();
+    if(!n)
+        return;
+    size_t nchunks = (n + Document::BLOCK_SIZE - 1) / Document::BLOCK_SIZE;
+    size_t done    = 0;
+    for(size_t i = 0; i < nchunks; ++i) {
+        size_t len   = (n - done) / (nchunks - i);
+        auto block   = std::make_shared<Document::Block>();
+        auto beg     = lines.begin() + done;
+        block->lines = vector<string>(std::make_move_iterator(beg),
+                                      std::make_move_iterator(beg + len));
+        block->bytes = sizeof(Document::Block) +
+                       block->lines.capacity() * sizeof(string);
+        for(const string& line : block->lines)
+            block->bytes += line.capacity();
+        out.push_back(std::move(block));
+        done += len;
+    }
+}
+
+const string& Document::Version::operator[](size_t linenum) const {
+    static const string empty;
+    if(linenum >= num_lines)
+        return empty;
+    size_t b = find_block(linenum);
+    return blocks[b]->lines[linenum - starts[b]];
+}
+
+size_t Document::Version::find_block(size_t linenum) const {
+    auto iter = std::upper_bound(starts.begin(), starts.end(), linenum);
+    if(iter == starts.begin())
+        return 0;
+    return (iter - starts.begin()) - 1;
+}
+
+Document::Document() : current(std::make_shared<Version>()) {}
+
+Document::Status Document::status() const {
+    Status result;
+    result.revision       = snapshot()->revision;
+    result.saved_revision = saved_revision;
+    result.dirty_since    = dirty_since;
+    result.checkpoint_revision = checkpoint_revision;
+    result.undo_bytes          = undo_bytes;
+    return result;
+}
+
+Document::Snapshot Document::snapshot() const {
+    return std::atomic_load(&current);
+}
+
+Document::Snapshot Document::snapshot(uint64_t max_revision) const {
+    Snapshot result = std::atomic_load(&current);
+    if(result->revision <= max_revision)
+        return result;
+    return std::atomic_load(&previous);
+}
+
+void Document::index(Version& next) {
+    next.starts.clear();
+    next.starts.reserve(next.blocks.size());
+    size_t line  = 0;
+    size_t bytes = 0;
+    for(const auto& block : next.blocks) {
+        next.starts.push_back(line);
+        line += block->lines.size();
+        bytes += block->bytes;
+    }
+    next.num_lines = line;
+    next.bytes     = bytes + next.blocks.capacity() *
+                                 (sizeof(next.blocks[0]) + sizeof(size_t));
+}
+
+void Document::publish(const shared_ptr<Version>& next) {
+    index(*next);
+    next->revision = revision;
+    std::atomic_store(&previous, current);
+    std::atomic_store(&current, Snapshot(next));
+}
+
+void Document::publish_draft() {
+    if(!draft)
+        return;
+    publish(draft);
+    draft.reset();
+}
+
+void Document::load(vector<string>&& lines,
+                    const string& path,
+                    uint64_t at) {
+    // an empty file does not hold the line added below
+    bool on_disk = !path.empty() && !lines.empty();
+    Snapshot loaded;
+    {
+        std::lock_guard<std::mutex> guard(write_mutex);
+        if(lines.empty())
+            lines.emplace_back();  // there is always a line to type in
+        auto next = std::make_shared<Version>();
+        chunk_lines(lines, next->blocks);
+        revision = std::max(revision + 1, at);
+        history.clear();
+        undo_history.clear();
+        undo_bytes = 0;
+        publish(next);
+        loaded = current;
+        // whatever the file holds counts as saved, even if writing it
+        // back would change its bytes
+        saved_revision      = revision;
+        dirty_since         = 0;
+        checkpoint_revision = 0;
+    }
+    std::lock_guard<std::mutex> guard(save_mutex);
+    saved.reset();
+    saved_blocks.clear();
+    if(on_disk)
+        set_saved(loaded, path);
+}
+
+bool Document::apply(
+    vector<Operation>& ops,
+    uint64_t base_revision,
+    const std::function<void(const vector<Operation>&)>& notify) {
+    std::lock_guard<std::mutex> guard(write_mutex);
+    if(base_revision > revision || revision - base_revision > history.size())
+        return false;
+    // everything after base_revision is new to the author
+    for(auto iter = history.end() - (revision - base_revision);
+        iter != history.end();
+        ++iter) {
+        Operation concurrent = *iter;
+        transform(concurrent, ops);
+    }
+    uint64_t now = get_timestamp();
+    for(size_t i = 0; i < ops.size(); ++i) {
+        Operation inverse;
+        apply(ops[i], inverse);
+        // a batch is undone at once
+        undo_history.record(ops[i], inverse, now, i > 0);
+    }
+    publish_draft();
+    undo_bytes = undo_history.memory();
+    notify(ops);
+    return true;
+}
+
+void Document::edit(const Operation& op) {
+    vector<Operation> ops(1, op);
+    apply(ops, snapshot()->get_revision(), [](const vector<Operation>&) {});
+}
+
+size_t Document::locate(Anchor& anchor) {
+    std::lock_guard<std::mutex> guard(write_mutex);
+    place(anchor);
+    return anchor.line;
+}
+
+void Document::refresh(Anchor& anchor) {
+    if(revision - anchor.revision >= HISTORY_SIZE / 2)
+        place(anchor);
+}
+
+void Document::place(Anchor& anchor) {
+    if(anchor.revision > revision ||
+       revision - anchor.revision > history.size()) {
+        size_t num_lines = current->size();
+        anchor.line      = std::min(anchor.line, num_lines ? num_lines - 1 : 0);
+    } else {
+        for(auto iter = history.end() - (revision - anchor.revision);
+            iter != history.end();
+            ++iter)
+            anchor.line = transform(Position(anchor.line, 0), *iter).line;
+    }
+    anchor.revision = revision;
+}
+
+bool Document::undo(
+    int author,
+    const std::function<void(const vector<Operation>&)>& notify) {
+    return revert(author, false, notify);
+}
+
+bool Document::redo(
+    int author,
+    const std::function<void(const vector<Operation>&)>& notify) {
+    return revert(author, true, notify);
+}
+
+bool Document::revert(
+    int author,
+    bool redo,
+    const std::function<void(const vector<Operation>&)>& notify) {
+    std::lock_guard<std::mutex> guard(write_mutex);
+    UndoHistory::Group group;
+    if(!undo_history.pop(author, redo, group)) {
+        undo_bytes = undo_history.memory();
+        return false;
+    }
+    if(revision - group.revision > history.size()) {
+        // too old to transform, and the rest is older still
+        undo_history.clear(author);
+        undo_bytes = undo_history.memory();
+        return false;
+    }
+    vector<Operation> ops(group.inverses.rbegin(), group.inverses.rend());
+    for(Operation& op : ops)
+        op.author = author;
+    for(auto iter = history.end() - (revision - group.revision);
+        iter != history.end();
+        ++iter) {
+        Operation concurrent = *iter;
+        transform(concurrent, ops);
+    }
+    vector<Operation> inverses;
+    for(Operation& op : ops) {
+        Operation inverse;
+        apply(op, inverse);
+        if(!inverse.isnoop())
+            inverses.push_back(std::move(inverse));
+    }
+    publish_draft();
+    if(!inverses.empty())
+        undo_history.push(author, !redo, std::move(inverses), revision);
+    undo_bytes = undo_history.memory();
+    notify(ops);
+    return true;
+}
+
+void Document::clear_undo(int author) {
+    std::lock_guard<std::mutex> guard(write_mutex);
+    undo_history.clear(author);
+    undo_bytes = undo_history.memory();
+}
+
+void Document::clear_undo() {
+    std::lock_guard<std::mutex> guard(write_mutex);
+    undo_history.clear();
+    undo_bytes = 0;
+}
+
+void Document::apply(Operation& op, Operation& inverse) {
+    const Version& old = latest();
+    if(!old.size())
+        op.type = Operation::NOOP;
+    // keep positions inside the document
+    auto clamp = [&old](Position& p) {
+        if(p.line >= old.size())
+            p = Position(old.size() - 1, old[old.size() - 1].size());
+        else
+            p.col = std::min(p.col, old[p.line].size());
+    };
+    if(!op.isnoop())
+        clamp(op.from);
+    if(op.type == Operation::ERASE) {
+        clamp(op.to);
+        if(!(op.from < op.to))
+            op.type = Operation::NOOP;
+    } else
+        op.to = op.from;
+
+    // a noop still takes a revision, the ones acknowledged to its author
+    // are counted per op
+    ++revision;
+    if(!op.isnoop()) {
+        if(!dirty_since)
+            dirty_since = get_timestamp();
+        size_t first, last, count;
+        op.line_effect(first, last, count);
+        vector<string> old_lines;
+        for(size_t i = first; i < last; ++i)
+            old_lines.push_back(old[i]);
+        op.revision = revision;
+        inverse     = op.inverse(old_lines);
+        splice(first, last - first, op.apply(old_lines));
+    }
+    op.revision = revision;
+    history.push_back(op);
+    if(history.size() > HISTORY_SIZE)
+        history.pop_front();
+}
+
+void Document::splice(size_t first, size_t count, vector<string>&& lines) {
+    const Version& old = latest();
+    first              = std::min(first, old.num_lines);
+    count              = std::min(count, old.num_lines - first);
+
+    // blocks [bb, eb) are rebuilt, the rest is shared with the old version
+    size_t bb = 0, eb = 0;
+    vector<string> merged;
+    if(!old.blocks.empty()) {
+        bb = old.find_block(first);
+        eb = (count ? old.find_block(first + count - 1) : bb) + 1;
+        const auto& head = old.blocks[bb]->lines;
+        const auto& tail = old.blocks[eb - 1]->lines;
+        size_t tail_from = first + count - old.starts[eb - 1];
+        merged.reserve(first - old.starts[bb] + lines.size() + tail.size() -
+                       tail_from);
+        merged.insert(
+            merged.end(), head.begin(), head.begin() + (first - old.starts[bb]));
+        std::move(lines.begin(), lines.end(), std::back_inserter(merged));
+        merged.insert(merged.end(), tail.begin() + tail_from, tail.end());
+        // keep blocks from getting too small after deletions
+        if(merged.size() < BLOCK_SIZE / 2 && eb < old.blocks.size()) {
+            const auto& next_lines = old.blocks[eb++]->lines;
+            merged.insert(merged.end(), next_lines.begin(), next_lines.end());
+        }
+    } else
+        merged = std::move(lines);
+
+    auto next = std::make_shared<Version>();
+    next->blocks.reserve(old.blocks.size() + merged.size() / BLOCK_SIZE + 1);
+    next->blocks.insert(
+        next->blocks.end(), old.blocks.begin(), old.blocks.begin() + bb);
+    chunk_lines(merged, next->blocks);
+    next->blocks.insert(
+        next->blocks.end(), old.blocks.begin() + eb, old.blocks.end());
+    index(*next);
+    draft = std::move(next);
+}
+
+bool Document::FileStamp::operator==(const FileStamp& other) const {
+    return inode == other.inode && size == other.size &&
+           mtime == other.mtime && mtime_nsec == other.mtime_nsec;
+}
+
+bool Document::stamp(const string& path, FileStamp& result) {
+    struct stat info;
+    if(::stat(path.c_str(), &info) < 0)
+        return false;
+    result.inode      = info.st_ino;
+    result.size       = info.st_size;
+    result.mtime      = info.st_mtim.tv_sec;
+    result.mtime_nsec = info.st_mtim.tv_nsec;
+    return true;
+}
+
+void Document::set_saved(const Snapshot& version, const string& path) {
+    saved_blocks.clear();
+    off_t offset = 0;
+    for(const auto& block : version->blocks) {
+        size_t len = 0;
+        for(const string& line : block->lines)
+            len += line.size() + 1;
+        saved_blocks[block.get()] = std::make_pair(offset, len);
+        offset += len;
+    }
+    // only trust the layout if it accounts for the whole file
+    if(!stamp(path, saved_stamp) || saved_stamp.size != offset) {
+        saved.reset();
+        saved_blocks.clear();
+        return;
+    }
+    saved = version;
+}
+
+// copy len bytes at offset of in to the end of out
+static bool copy_range(int in, off_t offset, int out, size_t len) {
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    // let the kernel (or the file system) do it without a round trip
+    while(len) {
+        ssize_t done = ::copy_file_range(in, &offset, out, nullptr, len, 0);
+        if(done < 0 && errno == EINTR)
+            continue;
+        if(done <= 0)
+            break;  // not supported here, fall back below
+        len -= done;
+    }
+#endif
+    char buffer[65536];
+    while(len) {
+        ssize_t done =
+            ::pread(in, buffer, std::min(len, sizeof(buffer)), offset);
+        if(done < 0 && errno == EINTR)
+            continue;
+        if(done <= 0 || !write_all(out, string(buffer, done)))
+            return false;
+        offset += done;
+        len -= done;
+    }
+    return true;
+}
+
+bool Document::save(const string& path,
+                    const string& temp_path,
+                    const string& mark_path,
+                    SaveStats& stats,
+                    const std::function<void(size_t)>& pace) {
+    std::lock_guard<std::mutex> guard(save_mutex);
+    uint64_t started = get_timestamp();
+    Snapshot next    = snapshot();
+    stats            = SaveStats();
+    stats.revision   = next->revision;
+
+    // the old file can only be reused if it is still what we wrote
+    int in = -1;
+    FileStamp now;
+    if(saved && stamp(path, now) && now == saved_stamp)
+        in = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    mode_t mode = ::stat(path.c_str(), &info) == 0 ? info.st_mode : 0644;
+    int out     = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if(out < 0) {
+        PERROR("Failed to create " << temp_path);
+        if(in >= 0)
+            ::close(in);
+        return false;
+    }
+
+    bool ok = true;
+    string buffer;
+    off_t copy_from = 0;
+    size_t copy_len = 0;  // bytes waiting to be copied from copy_from
+    auto flush      = [&]() {
+        if(!buffer.empty()) {
+            if(pace)
+                pace(buffer.size());
+            ok = ok && write_all(out, buffer);
+            stats.bytes_written += buffer.size();
+            buffer.clear();
+        }
+        while(copy_len) {
+            // a paced copy goes a piece at a time
+            size_t piece = pace ? std::min(copy_len, size_t(65536)) : copy_len;
+            if(pace)
+                pace(piece);
+            ok = ok && copy_range(in, copy_from, out, piece);
+            stats.bytes_copied += piece;
+            copy_from += piece;
+            copy_len -= piece;
+        }
+    };
+    for(const auto& block : next->blocks) {
+        auto iter = in < 0 ? saved_blocks.end() : saved_blocks.find(block.get());
+        if(iter != saved_blocks.end()) {
+            // unchanged since the last save, extend or start a copy
+            if(!buffer.empty() ||
+               (copy_len && copy_from + off_t(copy_len) != iter->second.first))
+                flush();
+            if(!copy_len)
+                copy_from = iter->second.first;
+            copy_len += iter->second.second;
+            continue;
+        }
+        if(copy_len)
+            flush();
+        for(const string& line : block->lines) {
+            buffer += line;
+            buffer.push_back('\n');
+        }
+        if(buffer.size() >= 65536)
+            flush();
+    }
+    flush();
+    if(in >= 0)
+        ::close(in);
+    ok = ::fdatasync(out) == 0 && ok;
+    ok = ::close(out) == 0 && ok;
+    // a rename keeps the stamp, so the mark knows the file once it is in
+    // place
+    FileStamp written;
+    ok = ok && stamp(temp_path, written) &&
+         mark(mark_path, next->revision, written);
+    if(!ok || ::rename(temp_path.c_str(), path.c_str()) < 0) {
+        PERROR("Failed to save " << path);
+        ::unlink(temp_path.c_str());
+        return false;
+    }
+    sync_directory(path);
+    stats.file_size = stats.bytes_written + stats.bytes_copied;
+    set_saved(next, path);
+    std::lock_guard<std::mutex> write_guard(write_mutex);
+    saved_revision = next->revision;
+    // edits made while saving are at most as old as the save, a batch of
+    // noops moves revision without publishing anything
+    dirty_since = current->revision == next->revision ? 0 : started;
+    return true;
+}
+
+// a save mark holds just this
+struct SaveMark {
+    char magic[8];
+    uint64_t revision;
+    // the file that was saved
+    uint64_t inode;
+    int64_t size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+};
+static const char SAVE_MARK_MAGIC[8] = {'H', 'R', 'M', 'S', 'M', 'R', 'K', '1'};
+
+bool Document::mark(const string& mark_path,
+                    uint64_t revision,
+                    const FileStamp& file) {
+    SaveMark mark;
+    std::memset(&mark, 0, sizeof(mark));
+    std::memcpy(mark.magic, SAVE_MARK_MAGIC, sizeof(mark.magic));
+    mark.revision   = revision;
+    mark.inode      = file.inode;
+    mark.size       = file.size;
+    mark.mtime      = file.mtime;
+    mark.mtime_nsec = file.mtime_nsec;
+    // written aside and renamed, a torn mark would be worse than none
+    const string temp_path = mark_path + ".tmp";
+    int out = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0) {
+        PERROR("Failed to create " << temp_path);
+        return false;
+    }
+    bool ok = write_all(
+        out, string(reinterpret_cast<const char*>(&mark), sizeof(mark)));
+    ok = ::fdatasync(out) == 0 && ok;
+    ok = ::close(out) == 0 && ok;
+    if(!ok || ::rename(temp_path.c_str(), mark_path.c_str()) < 0) {
+        PERROR("Failed to write " << mark_path);
+        ::unlink(temp_path.c_str());
+        return false;
+    }
+    sync_directory(mark_path);
+    return true;
+}
+
+uint64_t Document::marked_revision(const string& mark_path,
+                                   const string& path) {
+    int fd = ::open(mark_path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return 0;
+    SaveMark mark;
+    bool ok = ::read(fd, &mark, sizeof(mark)) == ssize_t(sizeof(mark)) &&
+              std::memcmp(mark.magic, SAVE_MARK_MAGIC,
+                          sizeof(mark.magic)) == 0;
+    ::close(fd);
+    FileStamp file;
+    // the save never got to replace path, or path changed since
+    ok = ok && stamp(path, file) && file.inode == ino_t(mark.inode) &&
+         file.size == off_t(mark.size) && file.mtime == mark.mtime &&
+         file.mtime_nsec == mark.mtime_nsec;
+    return ok ? mark.revision : 0;
+}
+
+// a checkpoint file starts with this, followed by num_lines + 1 offsets
+// into the text and the text itself, lines back to back
+struct CheckpointHeader {
+    char magic[8];
+    uint64_t revision;
+    uint64_t saved_revision;
+    uint64_t num_lines;
+    uint64_t text_size;
+    // the saved file when the checkpoint was taken
+    uint64_t inode;
+    int64_t size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+};
+static const char CHECKPOINT_MAGIC[8] = {
+    'H', 'R', 'M', 'S', 'C', 'K', 'P', '1'};
+
+bool Document::checkpoint(const string& path,
+                          const string& temp_path,
+                          const string& file_path,
+                          SaveStats& stats) {
+    std::lock_guard<std::mutex> guard(save_mutex);
+    Snapshot next  = snapshot();
+    stats          = SaveStats();
+    stats.revision = next->revision;
+
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.revision       = next->revision;
+    header.saved_revision = saved_revision;
+    header.num_lines      = next->num_lines;
+    FileStamp file;
+    if(stamp(file_path, file)) {
+        header.inode      = file.inode;
+        header.size       = file.size;
+        header.mtime      = file.mtime;
+        header.mtime_nsec = file.mtime_nsec;
+    }
+    vector<uint64_t> offsets;
+    offsets.reserve(next->num_lines + 1);
+    offsets.push_back(0);
+    for(const auto& block : next->blocks)
+        for(const string& line : block->lines)
+            offsets.push_back(offsets.back() + line.size());
+    header.text_size = offsets.back();
+
+    int out = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0) {
+        PERROR("Failed to create " << temp_path);
+        return false;
+    }
+    string buffer(reinterpret_cast<const char*>(&header), sizeof(header));
+    buffer.append(reinterpret_cast<const char*>(offsets.data()),
+                  offsets.size() * sizeof(uint64_t));
+    bool ok = true;
+    for(const auto& block : next->blocks) {
+        for(const string& line : block->lines)
+            buffer += line;
+        if(buffer.size() >= 65536) {
+            ok = ok && write_all(out, buffer);
+            stats.bytes_written += buffer.size();
+            buffer.clear();
+        }
+    }
+    ok = ok && write_all(out, buffer);
+    stats.bytes_written += buffer.size();
+    ok = ::fdatasync(out) == 0 && ok;
+    ok = ::close(out) == 0 && ok;
+    if(!ok || ::rename(temp_path.c_str(), path.c_str()) < 0) {
+        PERROR("Failed to write checkpoint " << path);
+        ::unlink(temp_path.c_str());
+        return false;
+    }
+    sync_directory(path);
+    stats.file_size = stats.bytes_written;
+    std::lock_guard<std::mutex> write_guard(write_mutex);
+    checkpoint_revision = next->revision;
+    return true;
+}
+
+bool Document::restore(const string& path, const string& file_path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat info;
+    void* data = MAP_FAILED;
+    if(::fstat(fd, &info) == 0 &&
+       size_t(info.st_size) >= sizeof(CheckpointHeader))
+        data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED)
+        return false;
+    ::madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+    const char* begin = static_cast<const char*>(data);
+    CheckpointHeader header;
+    std::memcpy(&header, begin, sizeof(header));
+    FileStamp file;
+    bool ok = std::memcmp(header.magic, CHECKPOINT_MAGIC,
+                          sizeof(header.magic)) == 0;
+    // the saved file changed under it, it does not continue from there
+    if(!stamp(file_path, file))
+        file = FileStamp();
+    ok = ok && file.inode == ino_t(header.inode) &&
+         file.size == off_t(header.size) && file.mtime == header.mtime &&
+         file.mtime_nsec == header.mtime_nsec;
+    size_t index_size = (header.num_lines + 1) * sizeof(uint64_t);
+    ok = ok && header.num_lines < size_t(info.st_size) &&
+         sizeof(header) + index_size + header.text_size ==
+             size_t(info.st_size);
+
+    vector<string> lines;
+    if(ok) {
+        const char* index = begin + sizeof(header);
+        const char* text  = index + index_size;
+        lines.reserve(header.num_lines);
+        uint64_t from;
+        std::memcpy(&from, index, sizeof(from));
+        for(size_t i = 1; ok && i <= header.num_lines; ++i) {
+            uint64_t to;
+            std::memcpy(&to, index + i * sizeof(to), sizeof(to));
+            ok = from <= to && to <= header.text_size;
+            if(ok)
+                lines.emplace_back(text + from, to - from);
+            from = to;
+        }
+    }
+    ::munmap(data, info.st_size);
+    if(!ok) {
+        PERROR("Ignoring checkpoint " << path);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(write_mutex);
+        if(lines.empty())
+            lines.emplace_back();
+        auto next = std::make_shared<Version>();
+        chunk_lines(lines, next->blocks);
+        // carry on from the checkpoint, the logged ops come after it
+        revision = header.revision;
+        history.clear();
+        undo_history.clear();
+        undo_bytes = 0;
+        publish(next);
+        saved_revision      = header.saved_revision;
+        dirty_since = saved_revision == revision ? 0 : get_timestamp();
+        checkpoint_revision = revision;
+    }
+    // the saved file does not hold these lines, the next save writes it all
+    std::lock_guard<std::mutex> guard(save_mutex);
+    saved.reset();
+    saved_blocks.clear();
+    return true;
+}
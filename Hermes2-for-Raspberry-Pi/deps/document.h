@@ -0,0 +1,242 @@
+#ifndef __DOCUMENT_H__
+#define __DOCUMENT_H__
+// A multi-version line store shared by all clients editing the same file.
+//
+// Readers take an immutable snapshot and never lock; a single writer at a
+// time builds the next version beside the current one and publishes it
+// atomically. Lines live in small blocks, so a new version only copies the
+// block index plus the blocks that were touched. Old versions are freed
+// once the last reader drops its snapshot.
+//
+// Saving writes a new file beside the old one and renames it into place.
+// Blocks still shared with the last saved version are copied from the old
+// file instead of being serialized again, so the bytes written follow the
+// edited ranges rather than the file size.
+//
+// Before a save replaces the file, a small mark beside it records the
+// revision it holds. The log is only cut back after the save, so after a
+// crash in between the mark tells which logged ops the file already has.
+//
+// A checkpoint dumps a version as a line index followed by the text, so
+// a restart maps it and builds the lines without parsing the file; only
+// the ops logged after it are replayed.
+//
+// Every change is an Operation. Clients send ops made against the last
+// revision they have seen; the document transforms them past whatever was
+// applied in the meantime (see operation.h), so concurrent edits merge
+// instead of overwriting each other. Undoing an edit is one more op, made
+// from its inverse (see undo.h).
+#include <sys/types.h>
+
+#include <atomic>
+#include <cinttypes>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "operation.h"
+#include "textmodel.h"
+#include "undo.h"
+
+using std::string;
+using std::vector;
+using std::uint64_t;
+
+class Document : public TextModel {
+public:
+    struct Block {
+        vector<string> lines;
+        size_t bytes = 0;  // rough memory footprint of lines
+    };
+
+    class Version {
+    public:
+        size_t size() const { return num_lines; }
+        uint64_t get_revision() const { return revision; }
+        // rough memory footprint of the lines, shared blocks included
+        size_t get_bytes() const { return bytes; }
+
+        // out of range lines read as empty strings
+        const string& operator[](size_t linenum) const;
+
+    private:
+        friend class Document;
+        // index of the block holding linenum
+        size_t find_block(size_t linenum) const;
+
+        vector<std::shared_ptr<const Block>> blocks;
+        vector<size_t> starts;  // first line number of each block
+        size_t num_lines  = 0;
+        size_t bytes      = 0;
+        uint64_t revision = 0;
+    };
+    typedef std::shared_ptr<const Version> Snapshot;
+
+    struct Status {
+        uint64_t revision       = 0;
+        uint64_t saved_revision = 0;  // revision the file on disk holds
+        uint64_t dirty_since    = 0;  // oldest unsaved edit, 0 when clean
+        uint64_t checkpoint_revision = 0;  // last checkpoint, 0 if none
+        size_t undo_bytes            = 0;  // held by the undo history
+    };
+
+    // A line number as of a revision. Nothing has to follow an edit to
+    // keep it right, the ops applied since are only replayed on it when
+    // it is read (see locate).
+    struct Anchor {
+        Anchor() = default;
+        Anchor(size_t l, uint64_t r) : line(l), revision(r) {}
+
+        size_t line       = 0;
+        uint64_t revision = 0;
+    };
+
+    struct SaveStats {
+        uint64_t revision      = 0;  // revision that was saved
+        uint64_t file_size     = 0;
+        uint64_t bytes_written = 0;  // serialized from changed blocks
+        uint64_t bytes_copied  = 0;  // reused from the old file
+    };
+
+    Document();
+    // disable copy constructor and assignment operator
+    Document(const Document& d) = delete;
+    Document& operator=(const Document& d) = delete;
+
+    // readers
+    Snapshot snapshot() const;
+    // the newest version no later than max_revision. A batch of ops is
+    // published as one version, so this holds for readers at most one
+    // batch behind, as a client is while its send mutex keeps the batch
+    // from reaching it.
+    Snapshot snapshot(uint64_t max_revision) const;
+    size_t size() const override { return snapshot()->size(); }
+    string line(size_t linenum) const override {
+        return (*snapshot())[linenum];
+    }
+    Status status() const;
+    // Move anchor past the ops applied since its revision and return its
+    // line now. Once its revision has left the history it stays where it
+    // was, kept inside the file, so whoever holds anchors has them
+    // refreshed. Not from a notify callback.
+    size_t locate(Anchor& anchor);
+    // from a notify callback: move anchor along if its revision is half
+    // way out of the history
+    void refresh(Anchor& anchor);
+
+    // writers
+    // path, if given, holds exactly these lines each followed by '\n', so
+    // the first save can reuse it; at, if given, is the revision the lines
+    // were saved at, so the logged ops after it keep their revisions
+    void load(vector<string>&& lines,
+              const string& path,
+              uint64_t at = 0);
+    void load(vector<string>&& lines) override { load(std::move(lines), ""); }
+    // apply op on top of the latest revision, as one batch nobody is told
+    // about
+    void edit(const Operation& op) override;
+    // Transform ops, made against base_revision, past the ops applied
+    // since then and apply them in order. notify gets the applied ops
+    // while the write lock is still held, so whoever it tells sees ops in
+    // revision order. Fails if base_revision has left the history.
+    bool apply(vector<Operation>& ops,
+               uint64_t base_revision,
+               const std::function<void(const vector<Operation>&)>& notify);
+    // take back the last group of edits author made, or redo the last one
+    // it took back; notify as in apply(). False if there is none left.
+    bool undo(int author,
+              const std::function<void(const vector<Operation>&)>& notify);
+    bool redo(int author,
+              const std::function<void(const vector<Operation>&)>& notify);
+    // forget what author, or everyone, could undo
+    void clear_undo(int author);
+    void clear_undo();
+
+    // write the current version to path through temp_path, which has to
+    // be on the same file system; mark_path records the revision before
+    // path is replaced. pace, if any, is called with the size of each
+    // piece before it is written and may block to hold the rate down.
+    bool save(const string& path,
+              const string& temp_path,
+              const string& mark_path,
+              SaveStats& stats,
+              const std::function<void(size_t)>& pace = nullptr);
+    // the revision a save marked in mark_path, 0 unless path is still the
+    // file that save wrote
+    static uint64_t marked_revision(const string& mark_path,
+                                    const string& path);
+    // write the current version to path through temp_path; the checkpoint
+    // only holds as long as the saved file at file_path is left alone
+    bool checkpoint(const string& path,
+                    const string& temp_path,
+                    const string& file_path,
+                    SaveStats& stats);
+    // load the checkpoint at path instead of the saved file, fails if
+    // there is none or it is stale
+    bool restore(const string& path, const string& file_path);
+
+    static const size_t BLOCK_SIZE   = 128;
+    static const size_t HISTORY_SIZE = 4096;  // ops kept for transforming
+
+private:
+    // replace count lines starting at first with lines, in the draft
+    void splice(size_t first, size_t count, vector<string>&& lines);
+    // clamp op to the draft and apply it, inverse gets the op that takes
+    // it back
+    void apply(Operation& op, Operation& inverse);
+    // the version being built, the current one if there is no draft
+    const Version& latest() const { return draft ? *draft : *current; }
+    // locate() with write_mutex held
+    void place(Anchor& anchor);
+    // publish the draft, if the batch changed anything
+    void publish_draft();
+    // line numbers and sizes of next's blocks
+    static void index(Version& next);
+    bool revert(int author,
+                bool redo,
+                const std::function<void(const vector<Operation>&)>& notify);
+    void publish(const std::shared_ptr<Version>& next);
+    // remember version as what path holds, save_mutex held
+    void set_saved(const Snapshot& version, const string& path);
+
+    std::mutex write_mutex;  // only one writer at a time
+    Snapshot current;
+    Snapshot previous;
+    // the version the ops of a batch build, published once they are all
+    // applied; write_mutex held
+    std::shared_ptr<Version> draft;
+    uint64_t revision = 0;
+    std::deque<Operation> history;  // the last ops, oldest first
+    UndoHistory undo_history;
+    // written with write_mutex held, read without locking
+    std::atomic<uint64_t> saved_revision{0};
+    std::atomic<uint64_t> dirty_since{0};
+    std::atomic<uint64_t> checkpoint_revision{0};
+    std::atomic<size_t> undo_bytes{0};
+
+    std::mutex save_mutex;  // one save at a time, guards the members below
+    Snapshot saved;         // version the file on disk holds
+    // where each block of saved sits in the file, as (offset, length)
+    std::unordered_map<const Block*, std::pair<off_t, size_t>> saved_blocks;
+    // identifies the saved file, so changes behind our back are noticed
+    struct FileStamp {
+        bool operator==(const FileStamp& other) const;
+        ino_t inode     = 0;
+        off_t size      = 0;
+        time_t mtime    = 0;
+        long mtime_nsec = 0;
+    };
+    static bool stamp(const string& path, FileStamp& result);
+    // record that file is about to be saved at revision, see save()
+    static bool mark(const string& mark_path,
+                     uint64_t revision,
+                     const FileStamp& file);
+    FileStamp saved_stamp;
+};
+
+#endif
@@ -6,11 +6,20 @@ bool Editor::init(int maxrow, int maxcol) {
         return false;
     dir.init(maxrow - 2, maxcol, 0, 0);
     file.init(maxrow - 2, maxcol, 0, 0);
+    idlok(file, true);  // let scroll_rows() use the terminal's scrolling
     status.init(maxrow, maxcol);
     is_init = true;
     return true;
 }
 
+void Editor::resize(int maxrow, int maxcol, size_t scrolled) {
+    if(!is_init)
+        return;
+    dir.resize(maxrow - 2, maxcol, 0, 0);
+    file.resize(maxrow - 2, maxcol, scrolled);
+    status.resize(maxrow, maxcol);
+}
+
 void Editor::switch_mode(int mode) {
     if(mode == -1)
         mode = !current_mode;  // the other mode
@@ -29,4 +38,20 @@ void Editor::switch_mode(int mode) {
         // more to do here
     }
     current_mode = mode;
-}
\ No newline at end of file
+}
+void Editor::render() {
+    if(!is_init)
+        return;
+    // the window staged last gets the cursor
+    if(current_mode == 1 && !prompting) {
+        status.draw();
+        file.draw();
+    } else {
+        if(current_mode == 1)
+            file.draw();
+        else
+            dir.draw();
+        status.draw();
+    }
+    doupdate();
+}
@@ -11,6 +11,8 @@ public:
     Editor& operator=(const Editor& e) = delete;
 
     bool init(int maxrow, int maxcol);  // initialized windows
+    // fit the windows to a resized terminal, see FileContent::resize()
+    void resize(int maxrow, int maxcol, size_t scrolled = 0);
 
     // access functions
     bool isinit() const { return is_init; }
@@ -19,10 +21,15 @@ public:
     // mode 1 = file mode
     // mode -1 = blindly switch to other mode
     void switch_mode(int mode = -1);
+    // Put everything drawn since the last frame on the screen with a
+    // single doupdate(), once per key or message handled. The cursor
+    // ends up in the file, or on the status bar while prompting.
+    void render();
 
     FileList dir;      // directory panel
     FileContent file;  // file contents
     StatusBar status;  // status_bar
+    bool prompting = false;  // a query is being typed on the status bar
 
 
 private:
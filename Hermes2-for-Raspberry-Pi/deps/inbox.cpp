@@ -0,0 +1,44 @@
+#include <cinttypes>
+#include <deque>
+#include <mutex>
+
+#include "inbox.h"
+
+using std::uint64_t;
+
+uint64_t Inbox::open(int reply) {
+    std::lock_guard<std::mutex> guard(mutex);
+    uint64_t id = next_id++;
+    queues[reply].push_back(id);
+    open_ids.insert(id);
+    return id;
+}
+
+bool Inbox::complete(int reply) {
+    std::lock_guard<std::mutex> guard(mutex);
+    std::deque<uint64_t>& queue = queues[reply];
+    if(queue.empty())
+        return false;
+    open_ids.erase(queue.front());
+    queue.pop_front();
+    done_cv.notify_all();
+    return true;
+}
+
+bool Inbox::wait(uint64_t id) {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this, id] { return closed || !open_ids.count(id); });
+    return !open_ids.count(id);
+}
+
+void Inbox::close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    closed = true;
+    done_cv.notify_all();
+}
+
+size_t Inbox::in_flight(int reply) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto iter = queues.find(reply);
+    return iter == queues.end() ? 0 : iter->second.size();
+}
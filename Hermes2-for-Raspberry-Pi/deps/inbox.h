@@ -0,0 +1,46 @@
+#ifndef __INBOX_H__
+#define __INBOX_H__
+// Requests a client has sent the server and not yet seen answered.
+//
+// The server answers the requests of a connection in the order they came
+// in, so an answer completes the oldest open request expecting it. The UI
+// thread notes each request as it goes out and either moves on, leaving
+// the message thread to act on the answer, or waits for it on a condition
+// variable instead of spinning. Any number can be in flight at once.
+#include <condition_variable>
+#include <cinttypes>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+using std::uint64_t;
+
+class Inbox {
+public:
+    Inbox() = default;
+    // disable copy constructor and assignment operator
+    Inbox(const Inbox& i) = delete;
+    Inbox& operator=(const Inbox& i) = delete;
+
+    // a request answered by a reply command is going out, returns its id
+    uint64_t open(int reply);
+    // the next reply command came in, false if nothing was waiting for it
+    bool complete(int reply);
+    // block until request id is answered, false if the inbox was closed
+    bool wait(uint64_t id);
+    // the connection is gone, let every waiter go
+    void close();
+    // requests waiting for reply
+    size_t in_flight(int reply);
+
+private:
+    std::mutex mutex;  // guards everything below
+    std::condition_variable done_cv;
+    std::unordered_map<int, std::deque<uint64_t>> queues;  // by reply
+    std::unordered_set<uint64_t> open_ids;
+    uint64_t next_id = 1;
+    bool closed      = false;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "linecache.h"
+
+using std::string;
+using std::vector;
+
+const size_t LineCache::BLOCK_LINES;
+const size_t LineCache::MAX_LINES;
+
+LineCache::Iterator LineCache::find(size_t linenum) {
+    auto iter = blocks.upper_bound(linenum);
+    if(iter == blocks.begin())
+        return blocks.end();
+    --iter;
+    if(linenum >= iter->first + iter->second.lines.size())
+        return blocks.end();
+    return iter;
+}
+
+bool LineCache::get(size_t linenum, string& line) {
+    auto iter = find(linenum);
+    if(iter == blocks.end())
+        return false;
+    line              = iter->second.lines[linenum - iter->first];
+    iter->second.used = ++clock;
+    return true;
+}
+
+void LineCache::put(size_t first, vector<string>&& lines) {
+    if(lines.empty())
+        return;
+    cut(first, first + lines.size());
+    Block& block = blocks[first];
+    block.lines.assign(std::make_move_iterator(lines.begin()),
+                       std::make_move_iterator(lines.end()));
+    block.used = ++clock;
+    total += block.lines.size();
+    evict();
+}
+
+void LineCache::put(size_t linenum, const string& line) {
+    auto iter = find(linenum);
+    if(iter != blocks.end()) {
+        iter->second.lines[linenum - iter->first] = line;
+        iter->second.used = ++clock;
+        return;
+    }
+    // a line scrolled out of the window sits next to the ones before it,
+    // so blocks grow instead of fragmenting, up to twice a fetched block
+    auto next = blocks.lower_bound(linenum);
+    auto prev = next == blocks.begin() ? blocks.end() : std::prev(next);
+    if(prev != blocks.end() &&
+       prev->first + prev->second.lines.size() == linenum &&
+       prev->second.lines.size() < 2 * BLOCK_LINES) {
+        prev->second.lines.push_back(line);
+        prev->second.used = ++clock;
+    } else if(next != blocks.end() && next->first == linenum + 1 &&
+              next->second.lines.size() < 2 * BLOCK_LINES) {
+        Block block = std::move(next->second);
+        blocks.erase(next);
+        block.lines.push_front(line);
+        block.used = ++clock;
+        blocks.emplace(linenum, std::move(block));
+    } else {
+        Block& block = blocks[linenum];
+        block.lines.push_back(line);
+        block.used = ++clock;
+    }
+    ++total;
+    evict();
+}
+
+void LineCache::apply(const Operation& op) {
+    if(op.isnoop() || blocks.empty())
+        return;
+    size_t first, last, count;
+    op.line_effect(first, last, count);
+    cut(first, last);
+    if(count == last - first)
+        return;
+    // every block left at or after last moves by the lines op adds
+    auto iter = blocks.lower_bound(last);
+    vector<std::pair<size_t, Block>> moved;
+    for(auto at = iter; at != blocks.end(); ++at)
+        moved.emplace_back(at->first - last + first + count,
+                           std::move(at->second));
+    blocks.erase(iter, blocks.end());
+    for(auto& block : moved)
+        blocks.emplace(block.first, std::move(block.second));
+}
+
+void LineCache::clear() {
+    blocks.clear();
+    total = 0;
+}
+
+size_t LineCache::missing(size_t from, size_t to, bool down) const {
+    // the block holding linenum, or end()
+    auto holding = [this](size_t linenum) {
+        auto iter = blocks.upper_bound(linenum);
+        if(iter == blocks.begin())
+            return blocks.end();
+        --iter;
+        return linenum < iter->first + iter->second.lines.size()
+                   ? iter
+                   : blocks.end();
+    };
+    if(down) {
+        for(size_t line = from; line < to;) {
+            auto iter = holding(line);
+            if(iter == blocks.end())
+                return line;
+            line = iter->first + iter->second.lines.size();
+        }
+    } else {
+        for(size_t line = to; line > from;) {
+            auto iter = holding(line - 1);
+            if(iter == blocks.end())
+                return line - 1;
+            line = iter->first;
+        }
+    }
+    return to;
+}
+
+void LineCache::cut(size_t first, size_t last) {
+    auto iter = blocks.upper_bound(first);
+    if(iter != blocks.begin())
+        --iter;
+    // an empty range still splits the block it falls inside
+    while(iter != blocks.end() && iter->first <= last) {
+        size_t start = iter->first;
+        size_t end   = start + iter->second.lines.size();
+        bool inside  = first < last ? start < last : start < first;
+        if(end <= first || !inside) {
+            ++iter;
+            continue;
+        }
+        Block block = std::move(iter->second);
+        iter        = blocks.erase(iter);
+        total -= block.lines.size();
+        if(end > last) {
+            Block& tail = blocks[last];
+            tail.lines.assign(block.lines.begin() + (last - start),
+                              block.lines.end());
+            tail.used = block.used;
+            total += tail.lines.size();
+        }
+        if(start < first) {
+            block.lines.resize(first - start);
+            total += block.lines.size();
+            blocks.emplace(start, std::move(block));
+        }
+    }
+}
+
+void LineCache::evict() {
+    while(total > max_lines && !blocks.empty()) {
+        auto oldest = blocks.begin();
+        for(auto iter = blocks.begin(); iter != blocks.end(); ++iter)
+            if(iter->second.used < oldest->second.used)
+                oldest = iter;
+        total -= oldest->second.lines.size();
+        blocks.erase(oldest);
+    }
+}
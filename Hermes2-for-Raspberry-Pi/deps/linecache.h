@@ -0,0 +1,64 @@
+#ifndef __LINECACHE_H__
+#define __LINECACHE_H__
+// Lines of the open file a client holds outside its window, so scrolling
+// onto them needs no round trip.
+//
+// Lines are kept in blocks of consecutive lines, and the least recently
+// used block goes once more than max_lines are held. Every op the window
+// takes goes through apply() as well: the lines it rewrites are dropped
+// and the ones after it renumbered, so what is left is always what the
+// server holds at the revision the client is at.
+#include <cinttypes>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "operation.h"
+
+using std::string;
+using std::vector;
+
+class LineCache {
+public:
+    explicit LineCache(size_t max_lines = MAX_LINES) : max_lines(max_lines) {}
+
+    // copy line linenum into line, false if it is not held
+    bool get(size_t linenum, string& line);
+    // lines starting at line first, in place of any held already
+    void put(size_t first, vector<string>&& lines);
+    // a single line, joined onto the block it continues if there is one
+    void put(size_t linenum, const string& line);
+    // renumber and drop lines the way op changes them
+    void apply(const Operation& op);
+    void clear();
+
+    // the first line not held in [from, to), or the last one when going
+    // up; to if every line is held
+    size_t missing(size_t from, size_t to, bool down) const;
+    size_t size() const { return total; }
+
+    static const size_t BLOCK_LINES = 64;  // lines fetched at a time
+    static const size_t MAX_LINES   = 64 * BLOCK_LINES;
+
+private:
+    struct Block {
+        std::deque<string> lines;
+        uint64_t used;  // clock when last read or written
+    };
+    typedef std::map<size_t, Block>::iterator Iterator;
+
+    // the block holding linenum, or end()
+    Iterator find(size_t linenum);
+    // drop the lines in [first, last)
+    void cut(size_t first, size_t last);
+    // drop least recently used blocks until under max_lines
+    void evict();
+
+    std::map<size_t, Block> blocks;  // by first line, never overlapping
+    size_t max_lines;
+    size_t total   = 0;
+    uint64_t clock = 0;
+};
+
+#endif
@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "operation.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+using std::uint64_t;
+
+bool operator==(const Position& a, const Position& b) {
+    return a.line == b.line && a.col == b.col;
+}
+
+bool operator!=(const Position& a, const Position& b) { return !(a == b); }
+
+bool operator<(const Position& a, const Position& b) {
+    return a.line < b.line || (a.line == b.line && a.col < b.col);
+}
+
+bool operator<=(const Position& a, const Position& b) { return !(b < a); }
+
+Operation Operation::insert(const Position& at, const string& text) {
+    Operation op;
+    if(text.empty())
+        return op;
+    op.type = INSERT;
+    op.from = op.to = at;
+    op.text         = text;
+    return op;
+}
+
+Operation Operation::erase(const Position& from, const Position& to) {
+    Operation op;
+    if(!(from < to))
+        return op;
+    op.type = ERASE;
+    op.from = from;
+    op.to   = to;
+    return op;
+}
+
+long Operation::line_delta() const {
+    switch(type) {
+        case INSERT:
+            return std::count(text.begin(), text.end(), '\n');
+        case ERASE:
+            return -static_cast<long>(to.line - from.line);
+        default:
+            return 0;
+    }
+}
+
+bool Operation::whole_lines() const {
+    if(type == INSERT)
+        return from.col == 0 && !text.empty() && text.back() == '\n';
+    return type == ERASE && from.col == 0 && to.col == 0;
+}
+
+void Operation::line_effect(size_t& first, size_t& last, size_t& count) const {
+    first = from.line;
+    switch(type) {
+        case INSERT:
+            count = std::count(text.begin(), text.end(), '\n');
+            if(whole_lines())
+                last = first;  // whole lines go in before from.line
+            else {
+                last = first + 1;
+                ++count;
+            }
+            break;
+        case ERASE:
+            if(whole_lines()) {
+                last  = to.line;  // whole lines are dropped
+                count = 0;
+            } else {
+                last  = to.line + 1;
+                count = 1;
+            }
+            break;
+        default:
+            last  = first;
+            count = 0;
+    }
+}
+
+vector<string> Operation::apply(const vector<string>& old_lines) const {
+    vector<string> result;
+    if(type == INSERT) {
+        size_t beg = 0, end;
+        while((end = text.find('\n', beg)) != string::npos) {
+            result.emplace_back(text, beg, end - beg);
+            beg = end + 1;
+        }
+        result.emplace_back(text, beg);
+        if(whole_lines()) {
+            result.pop_back();  // nothing follows the last new line
+            return result;
+        }
+        string line = old_lines.empty() ? "" : old_lines.front();
+        size_t col = std::min(from.col, line.size());
+        result.front().insert(0, line, 0, col);
+        result.back().append(line, col, string::npos);
+    } else if(type == ERASE) {
+        if(whole_lines())
+            return result;
+        string line;
+        if(!old_lines.empty()) {
+            const string& head = old_lines.front();
+            const string& tail = old_lines.back();
+            line.assign(head, 0, std::min(from.col, head.size()));
+            if(to.col < tail.size())
+                line.append(tail, to.col, string::npos);
+        }
+        result.push_back(std::move(line));
+    } else
+        result = old_lines;
+    return result;
+}
+
+Operation Operation::inverse(const vector<string>& old_lines) const {
+    Operation result;
+    if(type == INSERT) {
+        size_t newlines = line_delta();
+        Position end(from.line + newlines, from.col + text.size());
+        if(newlines)
+            end.col = text.size() - text.rfind('\n') - 1;
+        result = erase(from, end);
+    } else if(type == ERASE) {
+        // old_lines start at from.line
+        static const string none;
+        string erased;
+        for(size_t line = from.line; line <= to.line; ++line) {
+            size_t i = line - from.line;
+            const string& old = i < old_lines.size() ? old_lines[i] : none;
+            size_t beg = line == from.line ? from.col : 0;
+            size_t end = line == to.line ? to.col : old.size();
+            beg        = std::min(beg, old.size());
+            erased.append(old, beg, std::max(beg, end) - beg);
+            if(line != to.line)
+                erased.push_back('\n');
+        }
+        result = insert(from, erased);
+    }
+    result.author   = author;
+    result.revision = revision;
+    return result;
+}
+
+string Operation::encode() const {
+    string result;
+    result.push_back(static_cast<char>(type));
+    for(uint64_t field : {revision,
+                          static_cast<uint64_t>(author + 1),
+                          static_cast<uint64_t>(from.line),
+                          static_cast<uint64_t>(from.col),
+                          static_cast<uint64_t>(to.line),
+                          static_cast<uint64_t>(to.col)}) {
+        result.push_back(' ');
+        result += std::to_string(field);
+    }
+    result.push_back(' ');
+    result += text;
+    return result;
+}
+
+bool Operation::decode(const string& message, Operation& op) {
+    if(message.size() < 2 || message[1] != ' ')
+        return false;
+    op.type = static_cast<Type>(message[0]);
+    if(op.type != NOOP && op.type != INSERT && op.type != ERASE)
+        return false;
+    const char* curr = message.c_str() + 2;
+    uint64_t fields[6];
+    for(uint64_t& field : fields) {
+        char* end;
+        field = std::strtoull(curr, &end, 10);
+        if(end == curr || *end != ' ')
+            return false;
+        curr = end + 1;
+    }
+    op.revision = fields[0];
+    op.author   = static_cast<int>(fields[1]) - 1;
+    op.from     = Position(fields[2], fields[3]);
+    op.to       = Position(fields[4], fields[5]);
+    op.text.assign(curr);
+    return true;
+}
+
+Position transform(const Position& p, const Operation& op, bool stick_after) {
+    if(op.type == Operation::INSERT) {
+        const Position& q = op.from;
+        if(p < q || (p == q && !stick_after))
+            return p;
+        size_t newlines = op.line_delta();
+        if(p.line != q.line)
+            return Position(p.line + newlines, p.col);
+        size_t tail = op.text.size() - op.text.rfind('\n') - 1;
+        if(!newlines)
+            tail = q.col + op.text.size();
+        return Position(q.line + newlines, tail + p.col - q.col);
+    } else if(op.type == Operation::ERASE) {
+        if(p <= op.from)
+            return p;
+        if(p < op.to)
+            return op.from;
+        if(p.line == op.to.line)
+            return Position(op.from.line, op.from.col + p.col - op.to.col);
+        return Position(p.line - (op.to.line - op.from.line), p.col);
+    }
+    return p;
+}
+
+// a is an insertion, b an erasure
+static void transform_insert_erase(Operation& a, Operation& b) {
+    if(b.from < a.from && a.from < b.to) {
+        // the insertion lands inside the erased range, erasing wins
+        b.to   = transform(b.to, a);
+        a.type = Operation::NOOP;
+        return;
+    }
+    Position at = transform(a.from, b);
+    b.from      = transform(b.from, a, true);
+    b.to        = transform(b.to, a, false);
+    a.from = a.to = at;
+}
+
+void transform(Operation& a, Operation& b) {
+    if(a.isnoop() || b.isnoop())
+        return;
+    if(a.type == Operation::INSERT && b.type == Operation::INSERT) {
+        // on a tie the lower author id goes first
+        bool a_first = a.author < b.author;
+        Position pa  = transform(a.from, b, !a_first);
+        Position pb  = transform(b.from, a, a_first);
+        a.from = a.to = pa;
+        b.from = b.to = pb;
+    } else if(a.type == Operation::INSERT)
+        transform_insert_erase(a, b);
+    else if(b.type == Operation::INSERT)
+        transform_insert_erase(b, a);
+    else {
+        Operation old_a = a;
+        a.from          = transform(a.from, b);
+        a.to            = transform(a.to, b);
+        b.from          = transform(b.from, old_a);
+        b.to            = transform(b.to, old_a);
+        if(!(a.from < a.to))
+            a.type = Operation::NOOP;
+        if(!(b.from < b.to))
+            b.type = Operation::NOOP;
+    }
+}
+
+string encode_batch(uint64_t base_revision, const vector<Operation>& ops) {
+    string result = std::to_string(base_revision) + ' ' +
+                    std::to_string(ops.size()) + '\n';
+    for(const Operation& op : ops) {
+        string encoded = op.encode();
+        result += std::to_string(encoded.size());
+        result.push_back('\n');
+        result += encoded;
+    }
+    return result;
+}
+
+bool decode_batch(const string& message,
+                  uint64_t& base_revision,
+                  vector<Operation>& ops) {
+    const char* curr = message.c_str();
+    char* end;
+    base_revision = std::strtoull(curr, &end, 10);
+    size_t num    = std::strtoul(end, &end, 10);
+    if(*end != '\n')
+        return false;
+    size_t pos = end - message.c_str() + 1;
+    // num and the lengths come off the wire, nothing is sized by them
+    ops.clear();
+    while(num--) {
+        size_t len = std::strtoul(message.c_str() + pos, &end, 10);
+        if(*end != '\n')
+            return false;
+        pos = end - message.c_str() + 1;
+        if(len > message.size() - pos)
+            return false;
+        Operation op;
+        if(!Operation::decode(message.substr(pos, len), op))
+            return false;
+        ops.push_back(std::move(op));
+        pos += len;
+    }
+    return true;
+}
+
+void OperationBuffer::reset(uint64_t rev, int author_id) {
+    outstanding.clear();
+    buffered.clear();
+    revision = rev;
+    author   = author_id;
+}
+
+void OperationBuffer::push(Operation op) {
+    if(op.isnoop())
+        return;
+    op.author = author;
+    buffered.push_back(std::move(op));
+}
+
+const vector<Operation>& OperationBuffer::take_batch() {
+    outstanding.swap(buffered);
+    buffered.clear();
+    sent_at = get_timestamp();
+    return outstanding;
+}
+
+void OperationBuffer::ack(uint64_t rev) {
+    if(!outstanding.empty()) {
+        // weighted like TCP's smoothed round trip, new samples count 1/8
+        uint64_t sample = get_timestamp() - sent_at;
+        round_trip =
+            round_trip ? round_trip - round_trip / 8 + sample / 8 : sample;
+    }
+    outstanding.clear();
+    revision = rev;
+}
+
+Operation OperationBuffer::receive(Operation op) {
+    transform(op, outstanding);
+    transform(op, buffered);
+    revision = op.revision;
+    return op;
+}
+
+// how a line number moves across op, lines inside the rewritten range
+// collapse onto its first line and make shift_line return false
+static bool shift_line(size_t& line, const Operation& op, bool forward) {
+    size_t first, last, count;
+    op.line_effect(first, last, count);
+    size_t old_end = forward ? last : first + count;
+    size_t new_end = forward ? first + count : last;
+    if(line >= old_end) {
+        line = line - old_end + new_end;
+        return true;
+    }
+    if(line < first)
+        return true;
+    line = first;
+    return false;
+}
+
+bool OperationBuffer::to_local(size_t line, size_t& local) const {
+    bool untouched = true;
+    for(const Operation& op : outstanding)
+        untouched &= shift_line(line, op, true);
+    for(const Operation& op : buffered)
+        untouched &= shift_line(line, op, true);
+    local = line;
+    return untouched;
+}
+
+// how a position moves across op, false if op erases it
+static bool shift_position(Position& p, const Operation& op) {
+    bool erased = op.type == Operation::ERASE && op.from <= p && p < op.to;
+    p           = transform(p, op);
+    return !erased;
+}
+
+bool OperationBuffer::to_local(Position& p) const {
+    bool kept = true;
+    for(const Operation& op : outstanding)
+        kept &= shift_position(p, op);
+    for(const Operation& op : buffered)
+        kept &= shift_position(p, op);
+    return kept;
+}
+
+size_t OperationBuffer::to_server(size_t line) const {
+    for(auto iter = buffered.rbegin(); iter != buffered.rend(); ++iter)
+        shift_line(line, *iter, false);
+    for(auto iter = outstanding.rbegin(); iter != outstanding.rend(); ++iter)
+        shift_line(line, *iter, false);
+    return line;
+}
@@ -0,0 +1,127 @@
+#ifndef __OPERATION_H__
+#define __OPERATION_H__
+// Character level edits and the operational transformation (OT) rules
+// that let concurrent edits made against the same revision be merged.
+//
+// A document is treated as one long string in which '\n' separates lines,
+// so an edit is either an insertion of (possibly multi-line) text or the
+// erasure of a range. Positions are (line, column) pairs compared in
+// reading order.
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+using std::uint64_t;
+
+struct Position {
+    Position() = default;
+    Position(size_t l, size_t c) : line(l), col(c) {}
+    size_t line = 0;
+    size_t col  = 0;
+};
+
+bool operator==(const Position& a, const Position& b);
+bool operator!=(const Position& a, const Position& b);
+bool operator<(const Position& a, const Position& b);
+bool operator<=(const Position& a, const Position& b);
+
+struct Operation {
+    enum Type { NOOP = 'n', INSERT = 'i', ERASE = 'e' };
+
+    static Operation insert(const Position& at, const string& text);
+    static Operation erase(const Position& from, const Position& to);
+
+    bool isnoop() const { return type == NOOP; }
+    // inserts or erases whole lines only
+    bool whole_lines() const;
+    // number of lines added (negative when lines are removed)
+    long line_delta() const;
+
+    // The whole lines an operation rewrites: lines [first, last) of the
+    // old document are replaced by count new lines. Inserting full lines
+    // or erasing full lines leaves its neighbours untouched.
+    void line_effect(size_t& first, size_t& last, size_t& count) const;
+    // given old lines [first, last), produce the count replacement lines
+    vector<string> apply(const vector<string>& old_lines) const;
+    // the op that takes this one back, given the same old lines
+    Operation inverse(const vector<string>& old_lines) const;
+
+    string encode() const;
+    static bool decode(const string& message, Operation& op);
+
+    Type type = NOOP;
+    Position from;     // insertion point or start of the erased range
+    Position to;       // end of the erased range (exclusive)
+    string text;       // inserted text, '\n' starts a new line
+    int author        = -1;  // breaks ties between concurrent insertions
+    uint64_t revision = 0;   // server revision that applied it
+};
+
+// where p ends up after op is applied; when op inserts exactly at p,
+// p moves behind the new text only if stick_after is set
+Position transform(const Position& p,
+                   const Operation& op,
+                   bool stick_after = true);
+// a and b were made against the same document; afterwards a applies
+// after b and b applies after a, and both orders give the same result
+void transform(Operation& a, Operation& b);
+// transform a against every op in seq, seq is updated to apply after a
+template <typename Container>
+void transform(Operation& a, Container& seq) {
+    for(Operation& b : seq)
+        transform(a, b);
+}
+
+// batches of ops sent by a client against its last known revision
+string encode_batch(uint64_t base_revision, const vector<Operation>& ops);
+bool decode_batch(const string& message,
+                  uint64_t& base_revision,
+                  vector<Operation>& ops);
+
+// Client half of the OT protocol. Local edits are applied immediately and
+// queued here; at most one batch is in flight, the rest waits for its
+// acknowledgement. Remote ops are transformed past everything pending
+// before they are applied to the local copy. The time each batch takes to
+// be acknowledged is the latency this hides, and is kept as a smoothed
+// round trip.
+class OperationBuffer {
+public:
+    void reset(uint64_t rev, int author_id);
+    void push(Operation op);
+    // whether there is a batch ready to be sent
+    bool ready() const { return outstanding.empty() && !buffered.empty(); }
+    bool idle() const { return outstanding.empty() && buffered.empty(); }
+    // move the buffered ops in flight and return them
+    const vector<Operation>& take_batch();
+    // the batch in flight, as the server is going to apply it
+    const vector<Operation>& in_flight() const { return outstanding; }
+    void ack(uint64_t rev);
+    // returns op transformed so that it applies to the local copy
+    Operation receive(Operation op);
+
+    // map a line number from the server's revision to the local copy,
+    // false if a pending op rewrites that line
+    bool to_local(size_t line, size_t& local) const;
+    // map a whole position the same way, false if a pending op erases it
+    bool to_local(Position& p) const;
+    // map a local line number to the server's revision
+    size_t to_server(size_t line) const;
+
+    uint64_t get_revision() const { return revision; }
+    int get_author() const { return author; }
+    // smoothed time from sending a batch to its acknowledgement in ns, 0
+    // before the first one
+    uint64_t get_round_trip() const { return round_trip; }
+
+private:
+    vector<Operation> outstanding;  // sent, waiting for acknowledgement
+    vector<Operation> buffered;     // not sent yet
+    uint64_t revision   = 0;
+    int author          = -1;
+    uint64_t sent_at    = 0;  // when outstanding went out
+    uint64_t round_trip = 0;
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "oplog.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+using std::uint32_t;
+using std::uint64_t;
+
+const unsigned OpLog::COMMIT_WINDOW_MS;
+
+// FNV-1a, enough to tell a torn record from a whole one
+static uint32_t checksum(const string& data) {
+    uint32_t hash = 2166136261u;
+    for(unsigned char c : data) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// a record is "length checksum\n" followed by the encoded op and '\n'
+static string encode_record(const Operation& op) {
+    string payload = op.encode();
+    return std::to_string(payload.size()) + ' ' +
+           std::to_string(checksum(payload)) + '\n' + payload + '\n';
+}
+
+// decode whole records from the front of data, returns where they end
+static size_t decode_records(const string& data, vector<Operation>& ops) {
+    size_t pos = 0;
+    while(pos < data.size()) {
+        const char* head = data.c_str() + pos;
+        char* end;
+        size_t len   = std::strtoul(head, &end, 10);
+        uint32_t sum = std::strtoul(end, &end, 10);
+        if(*end != '\n')
+            break;
+        size_t beg = end - data.c_str() + 1;
+        if(beg + len >= data.size() || data[beg + len] != '\n')
+            break;
+        string payload = data.substr(beg, len);
+        Operation op;
+        if(checksum(payload) != sum || !Operation::decode(payload, op))
+            break;
+        ops.push_back(std::move(op));
+        pos = beg + len + 1;
+    }
+    return pos;
+}
+
+static bool read_file(const string& path, string& data) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return errno == ENOENT;  // nothing logged yet
+    char buffer[4096];
+    ssize_t len;
+    while((len = ::read(fd, buffer, sizeof(buffer))) > 0)
+        data.append(buffer, len);
+    ::close(fd);
+    return len == 0;
+}
+
+bool OpLog::open(const string& file_path, vector<Operation>& ops) {
+    close();
+    path = file_path;
+    string data;
+    if(!read_file(path, data)) {
+        PERROR("Failed to read " << path);
+        return false;
+    }
+    size_t valid = decode_records(data, ops);
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0) {
+        PERROR("Failed to open " << path);
+        return false;
+    }
+    if(valid < data.size()) {
+        PERROR("Dropping a torn record at the end of " << path);
+        if(::ftruncate(fd, valid) < 0) {
+            PERROR("Failed to truncate " << path);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        closing = false;
+        queue.clear();
+    }
+    thread = std::thread(&OpLog::flusher, this);
+    return true;
+}
+
+void OpLog::append(const vector<Operation>& ops) {
+    string records;
+    for(const Operation& op : ops)
+        if(!op.isnoop())
+            records += encode_record(op);
+    std::lock_guard<std::mutex> guard(mutex);
+    if(closing || records.empty())
+        return;
+    queue += records;
+    queued_cv.notify_one();
+}
+
+void OpLog::flusher() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        queued_cv.wait(lock, [this] { return !queue.empty() || closing; });
+        if(queue.empty())
+            break;  // closing with nothing left
+        // give other edits the commit window to join this write
+        lock.unlock();
+        if(!closing)
+            std::this_thread::sleep_for(
+                std::chrono::milliseconds(COMMIT_WINDOW_MS));
+        std::lock_guard<std::mutex> file_guard(file_mutex);
+        lock.lock();
+        string batch;
+        batch.swap(queue);
+        lock.unlock();
+
+        if(!write_all(fd, batch) || ::fdatasync(fd) < 0) {
+            PERROR("Failed to commit " << batch.size() << " bytes to "
+                                       << path);
+        }
+        lock.lock();
+    }
+}
+
+bool OpLog::read_all(vector<Operation>& ops) {
+    string data;
+    if(!read_file(path, data))
+        return false;
+    std::lock_guard<std::mutex> guard(mutex);
+    data += queue;
+    queue.clear();
+    decode_records(data, ops);
+    return true;
+}
+
+bool OpLog::replace(const vector<Operation>& ops) {
+    string data;
+    for(const Operation& op : ops)
+        if(!op.isnoop())
+            data += encode_record(op);
+    // write beside the old log, then swap it in
+    string temp = path + ".tmp";
+    int temp_fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(temp_fd < 0)
+        return false;
+    bool ok = write_all(temp_fd, data) && ::fdatasync(temp_fd) == 0;
+    ok      = ::close(temp_fd) == 0 && ok;
+    if(!ok || ::rename(temp.c_str(), path.c_str()) < 0) {
+        ::unlink(temp.c_str());
+        return false;
+    }
+    sync_directory(path);
+    ::close(fd);
+    fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+    return fd >= 0;
+}
+
+bool OpLog::rewrite(const vector<Operation>& ops) {
+    std::lock_guard<std::mutex> file_guard(file_mutex);
+    vector<Operation> old_ops;
+    if(fd < 0 || !read_all(old_ops))
+        return false;
+    return replace(ops);
+}
+
+bool OpLog::checkpoint(uint64_t revision) {
+    std::lock_guard<std::mutex> file_guard(file_mutex);
+    vector<Operation> ops;
+    if(fd < 0 || !read_all(ops))
+        return false;
+    ops.erase(std::remove_if(ops.begin(),
+                             ops.end(),
+                             [revision](const Operation& op) {
+                                 return op.revision <= revision;
+                             }),
+              ops.end());
+    return replace(ops);
+}
+
+void OpLog::close() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        closing = true;
+        queued_cv.notify_one();
+    }
+    if(thread.joinable())
+        thread.join();
+    std::lock_guard<std::mutex> file_guard(file_mutex);
+    if(fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
@@ -0,0 +1,65 @@
+#ifndef __OPLOG_H__
+#define __OPLOG_H__
+// An append-only log of the ops applied to a document since it was last
+// saved, so a crash does not lose unsaved edits.
+//
+// Appending only queues the encoded ops. A flusher thread waits for the
+// commit window to pass, then writes everything queued with one write()
+// and one fdatasync(), so a burst of edits from every client costs a
+// single small sequential write. On restart the surviving records are
+// replayed onto the saved file; a torn record at the end is cut off.
+#include <condition_variable>
+#include <cinttypes>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "operation.h"
+
+using std::string;
+using std::vector;
+using std::uint64_t;
+
+class OpLog {
+public:
+    OpLog() = default;
+    // disable copy constructor and assignment operator
+    OpLog(const OpLog& l) = delete;
+    OpLog& operator=(const OpLog& l) = delete;
+    ~OpLog() { close(); }
+
+    // open or create the log at path, ops gets the records it holds
+    bool open(const string& path, vector<Operation>& ops);
+    // queue ops for the next group commit
+    void append(const vector<Operation>& ops);
+    // replace the whole log with ops
+    bool rewrite(const vector<Operation>& ops);
+    // the document was saved at revision, drop the records it contains
+    bool checkpoint(uint64_t revision);
+    // flush and stop the flusher
+    void close();
+
+    bool isopen() const { return fd >= 0; }
+
+    static const unsigned COMMIT_WINDOW_MS = 10;
+
+private:
+    void flusher();
+    // with file_mutex held: take the records in the file and the queue
+    bool read_all(vector<Operation>& ops);
+    // with file_mutex held: swap in a new file holding ops
+    bool replace(const vector<Operation>& ops);
+
+    string path;
+    int fd = -1;
+    std::thread thread;
+    // held while the file is written, so a rewrite never races a commit
+    std::mutex file_mutex;
+    std::mutex mutex;  // guards everything below
+    std::condition_variable queued_cv;
+    string queue;         // encoded records waiting for the next commit
+    bool closing = true;  // not open yet
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "saver.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+using std::uint64_t;
+
+void Saver::start() {
+    std::lock_guard<std::mutex> guard(mutex);
+    stopping = false;
+    if(!thread.joinable())
+        thread = std::thread(&Saver::run, this);
+}
+
+void Saver::stop() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+        queued_cv.notify_one();
+    }
+    if(thread.joinable())
+        thread.join();
+}
+
+void Saver::request(const string& key,
+                    uint64_t revision,
+                    const SaveFunction& save,
+                    const void* owner,
+                    const DoneFunction& done) {
+    std::lock_guard<std::mutex> guard(mutex);
+    Job& job = jobs[key];
+    job.save = save;
+    job.waiters.push_back({revision, owner, done});
+    if(job.queued)
+        return;  // coalesce with the save already waiting
+    job.queued = true;
+    order.push_back(key);
+    queued_cv.notify_one();
+}
+
+void Saver::forget(const void* owner) {
+    std::lock_guard<std::mutex> done_guard(done_mutex);
+    std::lock_guard<std::mutex> guard(mutex);
+    for(auto& entry : jobs) {
+        auto& waiters = entry.second.waiters;
+        waiters.erase(std::remove_if(waiters.begin(),
+                                     waiters.end(),
+                                     [owner](const Waiter& waiter) {
+                                         return waiter.owner == owner;
+                                     }),
+                      waiters.end());
+    }
+}
+
+size_t Saver::queued(const string& key) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto iter = jobs.find(key);
+    return iter == jobs.end() ? 0 : iter->second.waiters.size();
+}
+
+size_t Saver::queue_depth() {
+    std::lock_guard<std::mutex> guard(mutex);
+    size_t result = 0;
+    for(const auto& entry : jobs)
+        result += entry.second.waiters.size();
+    return result;
+}
+
+void Saver::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        queued_cv.wait(lock, [this] { return !order.empty() || stopping; });
+        if(order.empty())
+            break;  // stopping with nothing left
+        string key = std::move(order.front());
+        order.pop_front();
+        Job& job   = jobs[key];
+        job.queued = false;
+        if(job.waiters.empty()) {
+            // everyone asking for it was satisfied or gone
+            jobs.erase(key);
+            continue;
+        }
+        SaveFunction save = job.save;
+        uint64_t started  = 0;
+        for(const Waiter& waiter : job.waiters)
+            started = std::max(started, waiter.revision);
+        lock.unlock();
+
+        Document::SaveStats stats;
+        bool ok = save(stats);
+
+        std::lock_guard<std::mutex> done_guard(done_mutex);
+        lock.lock();
+        // a successful save also covers requests made while it ran, as
+        // long as they did not see a later revision
+        uint64_t covered = ok ? std::max(started, stats.revision) : started;
+        Job& after       = jobs[key];
+        vector<Waiter> done;
+        auto iter        = std::stable_partition(
+            after.waiters.begin(),
+            after.waiters.end(),
+            [covered](const Waiter& waiter) {
+                return waiter.revision > covered;
+            });
+        std::move(iter, after.waiters.end(), std::back_inserter(done));
+        after.waiters.erase(iter, after.waiters.end());
+        if(after.waiters.empty() && !after.queued)
+            jobs.erase(key);
+        else if(!after.queued) {
+            after.queued = true;
+            order.push_back(key);
+        }
+        lock.unlock();
+        if(!ok) {
+            PERROR("Failed to save " << key);
+        }
+        for(const Waiter& waiter : done)
+            if(waiter.done)
+                waiter.done(ok, stats);
+        lock.lock();
+    }
+}
+
+WriteBudget::WriteBudget(int64_t rate)
+    : rate(rate), budget(rate), last(get_timestamp()), closed(rate <= 0) {}
+
+void WriteBudget::refill() {
+    const uint64_t second = 1000000000;
+    uint64_t now          = get_timestamp();
+    budget = std::min(rate, budget + int64_t(rate * (now - last) / second));
+    last   = now;
+}
+
+bool WriteBudget::available() {
+    std::lock_guard<std::mutex> guard(mutex);
+    refill();
+    return closed || budget > 0;
+}
+
+void WriteBudget::take(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex);
+    for(refill(); !closed && budget <= 0; refill()) {
+        // sleep about until the bucket is back above zero
+        int64_t wait = (1 - budget) * 1000 / rate + 1;
+        closed_cv.wait_for(lock, std::chrono::milliseconds(wait));
+    }
+    budget -= bytes;
+}
+
+void WriteBudget::close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    closed = true;
+    closed_cv.notify_all();
+}
@@ -0,0 +1,109 @@
+#ifndef __SAVER_H__
+#define __SAVER_H__
+// A dedicated I/O thread that saves documents, so no client thread waits
+// for the disk.
+//
+// A save writes from a snapshot, so editing goes on meanwhile. Requests
+// for a document that is already queued join that save instead of adding
+// another one; a request is answered by the first save that covers the
+// revision it was made at.
+#include <condition_variable>
+#include <cinttypes>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+using std::string;
+using std::vector;
+using std::uint64_t;
+
+class Saver {
+public:
+    typedef std::function<bool(Document::SaveStats&)> SaveFunction;
+    typedef std::function<void(bool, const Document::SaveStats&)>
+        DoneFunction;
+
+    Saver() = default;
+    // disable copy constructor and assignment operator
+    Saver(const Saver& s) = delete;
+    Saver& operator=(const Saver& s) = delete;
+    ~Saver() { stop(); }
+
+    void start();
+    // finish the queued saves and stop the thread
+    void stop();
+
+    // Queue save for key. done, if any, runs on the save thread once a
+    // save of key at or past revision is over; owner is what forget()
+    // looks for.
+    void request(const string& key,
+                 uint64_t revision,
+                 const SaveFunction& save,
+                 const void* owner      = nullptr,
+                 const DoneFunction& done = nullptr);
+    // drop the callbacks of owner; none of them runs once this returns
+    void forget(const void* owner);
+
+    // requests still waiting, for key or in total
+    size_t queued(const string& key);
+    size_t queue_depth();
+
+private:
+    struct Waiter {
+        uint64_t revision;
+        const void* owner;
+        DoneFunction done;
+    };
+    struct Job {
+        SaveFunction save;
+        vector<Waiter> waiters;
+        bool queued = false;
+    };
+
+    void run();
+
+    std::thread thread;
+    std::mutex done_mutex;  // held while callbacks run
+    std::mutex mutex;       // guards everything below
+    std::condition_variable queued_cv;
+    std::deque<string> order;  // keys in the order they were queued
+    std::unordered_map<string, Job> jobs;
+    bool stopping = false;
+};
+
+// A token bucket of bytes that paces the saves sharing it: a writer takes
+// what it is about to write and waits while the bucket is empty.
+class WriteBudget {
+public:
+    // rate in bytes per second, the bucket holds at most a second worth;
+    // a rate of 0 does not pace at all
+    explicit WriteBudget(int64_t rate);
+    WriteBudget(const WriteBudget& b) = delete;
+    WriteBudget& operator=(const WriteBudget& b) = delete;
+
+    // whether anything is left to write right now
+    bool available();
+    // wait until something is left, then take bytes; the bucket may go
+    // below zero, the next writer waits for it to refill
+    void take(size_t bytes);
+    // stop pacing, take() no longer waits
+    void close();
+
+private:
+    void refill();
+
+    std::mutex mutex;  // guards everything below
+    std::condition_variable closed_cv;
+    const int64_t rate;
+    int64_t budget;
+    uint64_t last;  // when the bucket was last refilled
+    bool closed;
+};
+
+#endif
@@ -0,0 +1,364 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "search.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+using std::uint32_t;
+
+const size_t SearchIndex::MAX_MATCHES;
+
+static inline uint32_t trigram(const char* p) {
+    return uint32_t(uint8_t(p[0])) << 16 | uint32_t(uint8_t(p[1])) << 8 |
+           uint8_t(p[2]);
+}
+
+// a read-only view of a whole file
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size      = 0;
+
+    explicit MappedFile(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            return;
+        struct stat info;
+        if(::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+           info.st_size > 0) {
+            void* map = ::mmap(
+                nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED) {
+                data = static_cast<const char*>(map);
+                size = info.st_size;
+            }
+        }
+        ::close(fd);
+    }
+    // disable copy constructor and assignment operator
+    MappedFile(const MappedFile& m) = delete;
+    MappedFile& operator=(const MappedFile& m) = delete;
+    ~MappedFile() {
+        if(data)
+            ::munmap(const_cast<char*>(data), size);
+    }
+};
+
+void SearchIndex::start(const string& dir, const OpenFunction& callback) {
+    stop();
+    root = dir;
+    if(root.empty() || root.back() != '/')
+        root.push_back('/');
+    open = callback;
+    seen.assign((1 << 24) / 64, 0);
+    std::lock_guard<std::mutex> guard(mutex);
+    stopping = false;
+    thread   = std::thread(&SearchIndex::run, this);
+}
+
+void SearchIndex::stop() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+        queued_cv.notify_one();
+    }
+    if(thread.joinable())
+        thread.join();
+}
+
+void SearchIndex::update(const string& path,
+                         const Document::Snapshot& version) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto iter = pending.find(path);
+    if(iter != pending.end()) {
+        iter->second = version;  // index whatever is newest instead
+        return;
+    }
+    pending.emplace(path, version);
+    order.push_back(path);
+    queued_cv.notify_one();
+}
+
+void SearchIndex::remove(const string& path) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if(pending.erase(path))
+        order.erase(std::find(order.begin(), order.end(), path));
+    if(path == indexing)
+        indexing.clear();  // so what is being read is not added back
+    drop(path);
+}
+
+size_t SearchIndex::size() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return ids.size();
+}
+
+size_t SearchIndex::queued() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return order.size();
+}
+
+void SearchIndex::trigrams(const char* data,
+                           size_t len,
+                           vector<uint32_t>& keys) {
+    for(size_t i = 0; i + 2 < len; ++i) {
+        if(data[i + 2] == '\n') {
+            i += 2;  // no window holding it is kept
+            continue;
+        }
+        if(data[i + 1] == '\n') {
+            ++i;
+            continue;
+        }
+        if(data[i] == '\n')
+            continue;
+        uint32_t key  = trigram(data + i);
+        uint64_t& bit = seen[key / 64];
+        if(bit & (uint64_t(1) << (key % 64)))
+            continue;
+        bit |= uint64_t(1) << (key % 64);
+        keys.push_back(key);
+    }
+}
+
+void SearchIndex::trigrams(const Document::Version& version,
+                           vector<uint32_t>& keys) {
+    for(size_t i = 0; i < version.size(); ++i) {
+        const string& line = version[i];
+        trigrams(line.data(), line.size(), keys);
+    }
+}
+
+void SearchIndex::add(const string& path, const vector<uint32_t>& keys) {
+    drop(path);
+    uint32_t id = paths.size();
+    paths.push_back(path);
+    ids[path] = id;
+    for(uint32_t key : keys)
+        postings[key].push_back(id);
+    ++generation;
+}
+
+void SearchIndex::drop(const string& path) {
+    auto iter = ids.find(path);
+    if(iter == ids.end())
+        return;
+    paths[iter->second].clear();
+    ids.erase(iter);
+    ++generation;
+    // the postings of a dead id are left for compact()
+    if(paths.size() > 1024 && paths.size() > 2 * ids.size())
+        compact();
+}
+
+void SearchIndex::compact() {
+    vector<uint32_t> renumber(paths.size(), UINT32_MAX);
+    vector<string> live;
+    for(size_t id = 0; id < paths.size(); ++id)
+        if(!paths[id].empty()) {
+            renumber[id] = live.size();
+            ids[paths[id]] = live.size();
+            live.push_back(std::move(paths[id]));
+        }
+    paths = std::move(live);
+    for(auto iter = postings.begin(); iter != postings.end();) {
+        // renumbering keeps the order, so postings stay sorted
+        vector<uint32_t>& list = iter->second;
+        size_t kept            = 0;
+        for(uint32_t id : list)
+            if(renumber[id] != UINT32_MAX)
+                list[kept++] = renumber[id];
+        list.resize(kept);
+        if(list.empty())
+            iter = postings.erase(iter);
+        else {
+            list.shrink_to_fit();
+            ++iter;
+        }
+    }
+}
+
+void SearchIndex::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        queued_cv.wait(lock, [this] { return !order.empty() || stopping; });
+        if(stopping)
+            break;
+        string path = std::move(order.front());
+        order.pop_front();
+        Document::Snapshot version = std::move(pending[path]);
+        pending.erase(path);
+        indexing = path;
+        lock.unlock();
+
+        vector<uint32_t> keys;
+        bool found = true;
+        if(version)
+            trigrams(*version, keys);
+        else {
+            MappedFile file(root + path);
+            struct stat info;
+            found = file.data || ::stat((root + path).c_str(), &info) == 0;
+            if(file.data)
+                trigrams(file.data, file.size, keys);
+        }
+        for(uint32_t key : keys)
+            seen[key / 64] = 0;
+
+        lock.lock();
+        if(indexing != path || pending.count(path))
+            continue;  // changed again meanwhile, the next pass counts
+        indexing.clear();
+        if(found)
+            add(path, keys);
+        else
+            drop(path);  // gone before it could be read
+    }
+}
+
+void SearchIndex::scan(const string& path,
+                       const string& text,
+                       vector<Match>& matches) {
+    Document::Snapshot version = open ? open(path) : nullptr;
+    if(version) {
+        for(size_t i = 0; i < version->size(); ++i) {
+            const string& line = (*version)[i];
+            for(size_t col = 0;; ++col) {
+                col = find_substring(line.data(), line.size(), text, col);
+                if(col == string::npos)
+                    break;
+                matches.push_back({path, i, col});
+                if(matches.size() >= MAX_MATCHES)
+                    return;
+            }
+        }
+        return;
+    }
+    MappedFile file(root + path);
+    const char* start = file.data;  // of the line last counted to
+    size_t line       = 0;
+    for(size_t at = 0; file.data && at < file.size;) {
+        at = find_substring(file.data, file.size, text, at);
+        if(at == string::npos)
+            break;
+        const char* hit = file.data + at;
+        const char* eol;
+        while((eol = static_cast<const char*>(
+                   ::memchr(start, '\n', hit - start)))) {
+            ++line;
+            start = eol + 1;
+        }
+        if(!std::memchr(hit, '\n', text.size())) {
+            matches.push_back({path, line, size_t(hit - start)});
+            if(matches.size() >= MAX_MATCHES)
+                return;
+        }
+        ++at;
+    }
+}
+
+void SearchIndex::search(const string& text,
+                         size_t offset,
+                         size_t count,
+                         vector<Match>& page,
+                         size_t& total) {
+    page.clear();
+    total = 0;
+    if(text.empty() || text.find('\n') != string::npos)
+        return;
+    std::lock_guard<std::mutex> search_guard(search_mutex);
+    vector<string> candidates;
+    uint64_t at;
+    bool fresh;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        at    = generation;
+        fresh = text != cached_text || at != cached_generation;
+        if(fresh) {
+            vector<uint32_t> keys;
+            for(size_t i = 0; i + 2 < text.size(); ++i)
+                keys.push_back(trigram(text.data() + i));
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            vector<const vector<uint32_t>*> lists;
+            bool none = false;  // some trigram is in no file at all
+            for(uint32_t key : keys) {
+                auto iter = postings.find(key);
+                if(iter == postings.end())
+                    none = true;
+                else
+                    lists.push_back(&iter->second);
+            }
+            // shortest first, so the running intersection stays small
+            std::sort(lists.begin(),
+                      lists.end(),
+                      [](const vector<uint32_t>* a,
+                         const vector<uint32_t>* b) {
+                          return a->size() < b->size();
+                      });
+            vector<uint32_t> found;
+            if(keys.empty()) {
+                // too short for a trigram, every file may hold it
+                for(const auto& entry : ids)
+                    candidates.push_back(entry.first);
+            } else if(!none) {
+                found = *lists[0];
+                for(size_t i = 1; i < lists.size() && !found.empty(); ++i) {
+                    vector<uint32_t> both;
+                    std::set_intersection(found.begin(),
+                                          found.end(),
+                                          lists[i]->begin(),
+                                          lists[i]->end(),
+                                          std::back_inserter(both));
+                    found = std::move(both);
+                }
+            }
+            for(uint32_t id : found)
+                if(!paths[id].empty())
+                    candidates.push_back(paths[id]);
+        }
+    }
+
+    if(fresh) {
+        vector<Match> matches;
+        std::sort(candidates.begin(), candidates.end());
+        for(const string& path : candidates) {
+            scan(path, text, matches);
+            if(matches.size() >= MAX_MATCHES)
+                break;
+        }
+        // rank files by how many matches they hold, keeping line order
+        std::unordered_map<string, size_t> per_file;
+        for(const Match& match : matches)
+            ++per_file[match.path];
+        std::stable_sort(matches.begin(),
+                         matches.end(),
+                         [&per_file](const Match& a, const Match& b) {
+                             size_t x = per_file[a.path];
+                             size_t y = per_file[b.path];
+                             return x != y ? x > y : a.path < b.path;
+                         });
+        cached_text       = text;
+        cached_generation = at;
+        cached            = std::move(matches);
+    }
+    // offset and count come from the client, offset + count can wrap
+    total  = cached.size();
+    offset = std::min(offset, total);
+    count  = std::min(count, total - offset);
+    page.assign(cached.begin() + offset, cached.begin() + offset + count);
+}
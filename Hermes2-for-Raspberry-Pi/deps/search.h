@@ -0,0 +1,113 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+// A trigram index over every file under a directory, for finding which
+// files hold a string without reading them all.
+//
+// Each file is broken into the three byte sequences it holds, and every
+// trigram maps to the sorted ids of the files holding it. A query only
+// reads the files holding all of its trigrams, and those are scanned to
+// find and place the matches. Keeping files rather than positions in the
+// postings keeps the index small enough for a Pi.
+//
+// Files are indexed on a thread of their own, from the disk or from a
+// snapshot of the document being edited. A file indexed again gets a new
+// id and its old one is dropped, so postings are only ever appended to.
+#include <condition_variable>
+#include <cinttypes>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+using std::string;
+using std::vector;
+using std::uint32_t;
+
+class SearchIndex {
+public:
+    struct Match {
+        string path;
+        size_t line;
+        size_t col;
+    };
+    // the version of path being edited, null if it is not open
+    typedef std::function<Document::Snapshot(const string& path)>
+        OpenFunction;
+
+    SearchIndex() = default;
+    // disable copy constructor and assignment operator
+    SearchIndex(const SearchIndex& s) = delete;
+    SearchIndex& operator=(const SearchIndex& s) = delete;
+    ~SearchIndex() { stop(); }
+
+    // paths are relative to root; open versions are searched in place of
+    // the files on disk
+    void start(const string& root, const OpenFunction& open);
+    void stop();
+
+    // index path again, from version if given or else from the disk
+    void update(const string& path,
+                const Document::Snapshot& version = nullptr);
+    void remove(const string& path);
+
+    // Matches of text, the files with the most of them first and in line
+    // order within a file. Files are read in path order until MAX_MATCHES
+    // are found. total gets the number of matches, page count of them
+    // starting at offset.
+    void search(const string& text,
+                size_t offset,
+                size_t count,
+                vector<Match>& page,
+                size_t& total);
+
+    // files indexed, and files waiting to be
+    size_t size();
+    size_t queued();
+
+    static const size_t MAX_MATCHES = 10000;
+
+private:
+    void run();
+    // the distinct trigrams of data, none of them across a line break
+    void trigrams(const char* data, size_t len, vector<uint32_t>& keys);
+    void trigrams(const Document::Version& version, vector<uint32_t>& keys);
+    // with mutex held: give path a new id holding keys
+    void add(const string& path, const vector<uint32_t>& keys);
+    // with mutex held: drop the id of path
+    void drop(const string& path);
+    // with mutex held: renumber the live ids once most are dead
+    void compact();
+    // add the matches of text in path to matches, up to MAX_MATCHES
+    void scan(const string& path,
+              const string& text,
+              vector<Match>& matches);
+
+    string root;
+    OpenFunction open;
+    std::thread thread;
+    vector<uint64_t> seen;  // bit per trigram, used by the index thread
+    std::mutex mutex;       // guards everything below
+    std::condition_variable queued_cv;
+    std::deque<string> order;  // paths in the order they were queued
+    // queued paths and the version to index, null to read the disk
+    std::unordered_map<string, Document::Snapshot> pending;
+    string indexing;  // path the index thread is reading
+    std::unordered_map<uint32_t, vector<uint32_t>> postings;
+    vector<string> paths;  // of each id, empty once dropped
+    std::unordered_map<string, uint32_t> ids;  // live id of each path
+    uint64_t generation = 0;                   // bumped on every change
+    bool stopping       = false;
+    // one query at a time; guards the last one, whose matches stay good
+    // until the index changes
+    std::mutex search_mutex;
+    string cached_text;
+    uint64_t cached_generation = UINT64_MAX;
+    vector<Match> cached;
+};
+
+#endif
@@ -0,0 +1,527 @@
+#include <algorithm>
+#include <cinttypes>
+#include <climits>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sequence.h"
+
+using std::string;
+using std::vector;
+using std::uint64_t;
+
+const int Sequence::ROOT_SITE;
+const size_t Sequence::MAX_RUN;
+
+bool operator==(const SequenceId& a, const SequenceId& b) {
+    return a.site == b.site && a.clock == b.clock;
+}
+
+// later clocks sort last, so a newer insertion goes in front of older ones
+bool operator<(const SequenceId& a, const SequenceId& b) {
+    return a.clock < b.clock || (a.clock == b.clock && a.site < b.site);
+}
+
+string SequenceOp::encode() const {
+    vector<uint64_t> fields;
+    if(type == INSERT)
+        fields = {static_cast<uint64_t>(id.site + 1),
+                  id.clock,
+                  static_cast<uint64_t>(origin.site + 1),
+                  origin.clock};
+    else if(type == ERASE) {
+        fields.push_back(ranges.size());
+        for(const Range& range : ranges) {
+            fields.push_back(static_cast<uint64_t>(range.site + 1));
+            fields.push_back(range.clock);
+            fields.push_back(range.len);
+        }
+    }
+    string result;
+    result.push_back(static_cast<char>(type));
+    for(uint64_t field : fields) {
+        result.push_back(' ');
+        result += std::to_string(field);
+    }
+    result.push_back(' ');
+    result += text;
+    return result;
+}
+
+bool SequenceOp::decode(const string& message, SequenceOp& op) {
+    if(message.size() < 2 || message[1] != ' ')
+        return false;
+    op.type = static_cast<Type>(message[0]);
+    if(op.type != NOOP && op.type != INSERT && op.type != ERASE)
+        return false;
+    const char* curr = message.c_str() + 2;
+    auto next_field  = [&curr](uint64_t& field) {
+        char* end;
+        field = std::strtoull(curr, &end, 10);
+        if(end == curr || *end != ' ')
+            return false;
+        curr = end + 1;
+        return true;
+    };
+    op.ranges.clear();
+    op.text.clear();
+    if(op.type == INSERT) {
+        uint64_t fields[4];
+        for(uint64_t& field : fields)
+            if(!next_field(field))
+                return false;
+        op.id     = SequenceId(static_cast<int>(fields[0]) - 1, fields[1]);
+        op.origin = SequenceId(static_cast<int>(fields[2]) - 1, fields[3]);
+        op.text.assign(curr);
+        return !op.id.isnull() && !op.text.empty();
+    }
+    if(op.type == ERASE) {
+        uint64_t num;
+        if(!next_field(num))
+            return false;
+        while(num--) {
+            uint64_t fields[3];
+            for(uint64_t& field : fields)
+                if(!next_field(field))
+                    return false;
+            op.ranges.push_back(
+                {static_cast<int>(fields[0]) - 1, fields[1], fields[2]});
+        }
+    }
+    return true;
+}
+
+Sequence::Sequence(int site_id) : site(site_id) {}
+
+size_t Sequence::chars(const Run* run) {
+    return run->deleted ? 0 : run->len;
+}
+
+size_t Sequence::lines(const Run* run) {
+    return run->deleted ? 0 : run->newlines;
+}
+
+Sequence::Run* Sequence::new_run(const SequenceId& id,
+                                 string&& text,
+                                 bool deleted) {
+    // xorshift, only has to be random enough to balance the treap
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    runs.emplace_back();
+    Run* run      = &runs.back();
+    run->id       = id;
+    run->len      = text.size();
+    run->newlines = std::count(text.begin(), text.end(), '\n');
+    run->deleted  = deleted;
+    run->priority = seed;
+    if(!deleted)
+        run->text = std::move(text);
+    index[id.site][id.clock] = run;
+    return run;
+}
+
+void Sequence::update(Run* run) {
+    run->chars_sum    = chars(run);
+    run->newlines_sum = lines(run);
+    for(Run* child : {run->left, run->right})
+        if(child) {
+            run->chars_sum += child->chars_sum;
+            run->newlines_sum += child->newlines_sum;
+        }
+}
+
+void Sequence::update_path(Run* run) {
+    for(; run; run = run->parent)
+        update(run);
+}
+
+void Sequence::rotate_up(Run* run) {
+    Run* parent = run->parent;
+    Run* grand  = parent->parent;
+    if(run == parent->left) {
+        parent->left = run->right;
+        if(run->right)
+            run->right->parent = parent;
+        run->right = parent;
+    } else {
+        parent->right = run->left;
+        if(run->left)
+            run->left->parent = parent;
+        run->left = parent;
+    }
+    parent->parent = run;
+    run->parent    = grand;
+    if(!grand)
+        root = run;
+    else if(grand->left == parent)
+        grand->left = run;
+    else
+        grand->right = run;
+    update(parent);
+    update(run);
+}
+
+void Sequence::insert_after(Run* prev, Run* run) {
+    // attach as the leftmost node of whatever follows prev
+    Run* parent = prev;
+    bool left   = false;
+    if(!prev) {
+        parent = root;
+        left   = true;
+    } else if(prev->right) {
+        parent = prev->right;
+        left   = true;
+    }
+    if(parent && left)
+        while(parent->left)
+            parent = parent->left;
+    run->parent = parent;
+    if(!parent)
+        root = run;
+    else if(left)
+        parent->left = run;
+    else
+        parent->right = run;
+    update_path(run);
+    while(run->parent && run->parent->priority < run->priority)
+        rotate_up(run);
+}
+
+Sequence::Run* Sequence::next(Run* run) {
+    if(run->right) {
+        run = run->right;
+        while(run->left)
+            run = run->left;
+        return run;
+    }
+    while(run->parent && run == run->parent->right)
+        run = run->parent;
+    return run->parent;
+}
+
+Sequence::Run* Sequence::split(Run* run, size_t at) {
+    string tail;
+    if(!run->deleted) {
+        tail.assign(run->text, at, string::npos);
+        run->text.resize(at);
+        run->newlines =
+            std::count(run->text.begin(), run->text.end(), '\n');
+    }
+    size_t tail_len = run->len - at;
+    run->len        = at;
+    update_path(run);
+    Run* half = new_run(SequenceId(run->id.site, run->id.clock + at),
+                        std::move(tail),
+                        run->deleted);
+    half->len = tail_len;
+    insert_after(run, half);
+    return half;
+}
+
+Sequence::Run* Sequence::find(const SequenceId& id, size_t& at) const {
+    auto site_iter = index.find(id.site);
+    if(site_iter == index.end())
+        return nullptr;
+    auto iter = site_iter->second.upper_bound(id.clock);
+    if(iter == site_iter->second.begin())
+        return nullptr;
+    Run* run = (--iter)->second;
+    if(id.clock >= run->id.clock + run->len)
+        return nullptr;
+    at = id.clock - run->id.clock;
+    return run;
+}
+
+Sequence::Run* Sequence::find(size_t offset, size_t& at) const {
+    Run* run = root;
+    while(run) {
+        if(run->left && offset < run->left->chars_sum) {
+            run = run->left;
+            continue;
+        }
+        if(run->left)
+            offset -= run->left->chars_sum;
+        if(offset < chars(run)) {
+            at = offset;
+            return run;
+        }
+        offset -= chars(run);
+        run = run->right;
+    }
+    return nullptr;
+}
+
+// offset of the first character of linenum
+size_t Sequence::line_start(size_t linenum) const {
+    size_t offset = 0;
+    Run* run      = root;
+    while(run && linenum) {
+        if(run->left && linenum <= run->left->newlines_sum) {
+            run = run->left;
+            continue;
+        }
+        if(run->left) {
+            linenum -= run->left->newlines_sum;
+            offset += run->left->chars_sum;
+        }
+        if(linenum <= lines(run)) {
+            size_t at = 0;
+            while(linenum--)
+                at = run->text.find('\n', at) + 1;
+            return offset + at;
+        }
+        linenum -= lines(run);
+        offset += chars(run);
+        run = run->right;
+    }
+    return offset;
+}
+
+size_t Sequence::to_offset(const Position& p) const {
+    size_t total = root ? root->chars_sum : 0;
+    size_t n     = size();
+    if(p.line >= n)
+        return total;
+    size_t beg = line_start(p.line);
+    size_t end = p.line + 1 < n ? line_start(p.line + 1) - 1 : total;
+    return beg + std::min(p.col, end - beg);
+}
+
+Position Sequence::to_position(const Run* run, size_t at) const {
+    size_t offset = at;
+    size_t line   = std::count(run->text.begin(), run->text.begin() + at, '\n');
+    auto add      = [&offset, &line](const Run* r) {
+        if(r) {
+            offset += r->chars_sum;
+            line += r->newlines_sum;
+        }
+    };
+    add(run->left);
+    for(; run->parent; run = run->parent)
+        if(run == run->parent->right) {
+            add(run->parent->left);
+            offset += chars(run->parent);
+            line += lines(run->parent);
+        }
+    return Position(line, offset - line_start(line));
+}
+
+size_t Sequence::size() const {
+    return root ? root->newlines_sum + 1 : 1;
+}
+
+string Sequence::operator[](size_t linenum) const {
+    string line;
+    if(linenum >= size())
+        return line;
+    size_t at;
+    for(Run* run = find(line_start(linenum), at); run; run = next(run)) {
+        if(run->deleted)
+            continue;
+        size_t end = run->text.find('\n', at);
+        if(end != string::npos) {
+            line.append(run->text, at, end - at);
+            break;
+        }
+        line.append(run->text, at, string::npos);
+        at = 0;
+    }
+    return line;
+}
+
+string Sequence::text() const {
+    string result;
+    if(!root)
+        return result;
+    result.reserve(root->chars_sum);
+    Run* run = root;
+    while(run->left)
+        run = run->left;
+    for(; run; run = next(run))
+        result += run->text;
+    return result;
+}
+
+void Sequence::load(vector<string>&& lines) {
+    root  = nullptr;
+    clock = 0;
+    runs.clear();
+    index.clear();
+    waiting.clear();
+    string all;
+    for(size_t i = 0; i < lines.size(); ++i) {
+        if(i)
+            all.push_back('\n');
+        all += lines[i];
+    }
+    clock = all.size();
+    Run* prev = nullptr;
+    for(size_t i = 0; i < all.size(); i += MAX_RUN) {
+        Run* run = new_run(
+            SequenceId(ROOT_SITE, i + 1), all.substr(i, MAX_RUN), false);
+        insert_after(prev, run);
+        prev = run;
+    }
+}
+
+SequenceOp Sequence::apply(const Operation& op) {
+    SequenceOp result;
+    if(op.type == Operation::INSERT && !op.text.empty()) {
+        size_t offset = to_offset(op.from);
+        result.type   = SequenceOp::INSERT;
+        result.id     = SequenceId(site, clock + 1);
+        result.text   = op.text;
+        size_t at;
+        if(offset) {
+            Run* run      = find(offset - 1, at);
+            result.origin = SequenceId(run->id.site, run->id.clock + at);
+        }
+        integrate(result, nullptr);
+    } else if(op.type == Operation::ERASE) {
+        size_t offset = to_offset(op.from);
+        size_t len    = to_offset(op.to);
+        len           = len > offset ? len - offset : 0;
+        while(len) {
+            size_t at;
+            Run* run = find(offset, at);
+            if(at)
+                run = split(run, at);
+            if(run->len > len)
+                split(run, len);
+            auto& ranges = result.ranges;
+            if(!ranges.empty() && ranges.back().site == run->id.site &&
+               ranges.back().clock + ranges.back().len == run->id.clock)
+                ranges.back().len += run->len;
+            else
+                ranges.push_back({run->id.site, run->id.clock, run->len});
+            len -= run->len;
+            erase(run, nullptr);
+        }
+        if(!result.ranges.empty())
+            result.type = SequenceOp::ERASE;
+    }
+    return result;
+}
+
+void Sequence::merge(const SequenceOp& op, vector<Operation>& applied) {
+    vector<SequenceOp> ready(1, op);
+    while(!ready.empty()) {
+        SequenceOp curr = std::move(ready.back());
+        ready.pop_back();
+        SequenceId id = missing(curr);
+        if(!id.isnull()) {
+            waiting.emplace(id, std::move(curr));
+            continue;
+        }
+        integrate(curr, &applied);
+        if(curr.type != SequenceOp::INSERT)
+            continue;
+        // wake up the ops waiting for the new characters
+        uint64_t end = curr.id.clock + curr.text.size();
+        auto iter    = waiting.lower_bound(SequenceId(INT_MIN, curr.id.clock));
+        while(iter != waiting.end() && iter->first.clock < end) {
+            if(iter->first.site == curr.id.site) {
+                ready.push_back(std::move(iter->second));
+                iter = waiting.erase(iter);
+            } else
+                ++iter;
+        }
+    }
+}
+
+SequenceId Sequence::missing(const SequenceOp& op) const {
+    size_t at;
+    if(op.type == SequenceOp::INSERT && !op.origin.isnull() &&
+       !find(op.origin, at))
+        return op.origin;
+    for(const SequenceOp::Range& range : op.ranges) {
+        SequenceId id(range.site, range.clock);
+        while(id.clock < range.clock + range.len) {
+            Run* run = find(id, at);
+            if(!run)
+                return id;
+            id.clock = run->id.clock + run->len;
+        }
+    }
+    return SequenceId();
+}
+
+void Sequence::integrate(const SequenceOp& op, vector<Operation>* applied) {
+    size_t at;
+    if(op.type == SequenceOp::ERASE) {
+        for(const SequenceOp::Range& range : op.ranges) {
+            SequenceId id(range.site, range.clock);
+            uint64_t end = range.clock + range.len;
+            while(id.clock < end) {
+                Run* run = find(id, at);
+                if(at)
+                    run = split(run, at);
+                if(run->id.clock + run->len > end)
+                    split(run, end - run->id.clock);
+                erase(run, applied);
+                id.clock += run->len;
+            }
+        }
+        return;
+    }
+    if(op.type != SequenceOp::INSERT || find(op.id, at))
+        return;  // nothing to do or seen before
+
+    Run* prev   = nullptr;
+    Run* origin = nullptr;
+    if(!op.origin.isnull()) {
+        origin = prev = find(op.origin, at);
+        if(at + 1 < prev->len)
+            split(prev, at + 1);
+    }
+    Run* after = prev ? next(prev) : root;
+    if(!prev && after)
+        while(after->left)
+            after = after->left;
+    // skip over newer insertions at the same place
+    while(after && op.id < after->id) {
+        prev  = after;
+        after = next(after);
+    }
+    clock = std::max(clock, op.id.clock + op.text.size() - 1);
+
+    Run* run;
+    if(prev && prev == origin && !prev->deleted &&
+       prev->id.site == op.id.site &&
+       prev->id.clock + prev->len == op.id.clock &&
+       prev->len + op.text.size() <= MAX_RUN) {
+        // typed right after the same site's run, extend it
+        run = prev;
+        at  = run->len;
+        run->text += op.text;
+        run->len += op.text.size();
+        run->newlines += std::count(op.text.begin(), op.text.end(), '\n');
+        update_path(run);
+    } else {
+        run = new_run(op.id, string(op.text), false);
+        at  = 0;
+        insert_after(prev, run);
+    }
+    if(applied)
+        applied->push_back(Operation::insert(to_position(run, at), op.text));
+}
+
+void Sequence::erase(Run* run, vector<Operation>* applied) {
+    if(run->deleted)
+        return;
+    if(applied) {
+        Position from = to_position(run, 0);
+        Position to(from.line, from.col + run->len);
+        if(run->newlines)
+            to = Position(from.line + run->newlines,
+                          run->len - run->text.rfind('\n') - 1);
+        applied->push_back(Operation::erase(from, to));
+    }
+    run->deleted = true;
+    run->text.clear();
+    run->text.shrink_to_fit();
+    update_path(run);
+}
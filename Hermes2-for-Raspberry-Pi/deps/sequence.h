@@ -0,0 +1,147 @@
+#ifndef __SEQUENCE_H__
+#define __SEQUENCE_H__
+// A sequence CRDT (RGA) holding the same text as a Document, for replicas
+// that exchange edits directly instead of going through the server's
+// transform step.
+//
+// Every character gets a unique id (Lamport clock, site). An insertion
+// names the character it goes after, erased characters stay behind as
+// tombstones, so replicas that have seen the same ops hold the same text
+// no matter in which order the ops arrived. Ops whose dependencies have
+// not arrived yet wait inside the sequence until they do.
+//
+// Characters typed one after another by the same site are kept together
+// as one run, so an append-heavy log costs little more than its text.
+// Runs sit in a treap ordered by position and counting visible characters
+// and newlines, so positions, lines and ids are found in O(log n).
+//
+// Not thread safe, each replica is owned by a single thread.
+#include <cinttypes>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "operation.h"
+#include "textmodel.h"
+
+using std::string;
+using std::vector;
+using std::uint64_t;
+
+struct SequenceId {
+    SequenceId() = default;
+    SequenceId(int s, uint64_t c) : site(s), clock(c) {}
+    bool isnull() const { return clock == 0; }
+    int site       = 0;
+    uint64_t clock = 0;  // 0 is the start of the document
+};
+
+bool operator==(const SequenceId& a, const SequenceId& b);
+bool operator<(const SequenceId& a, const SequenceId& b);
+
+struct SequenceOp {
+    enum Type { NOOP = 'n', INSERT = 'i', ERASE = 'e' };
+    // ids [clock, clock + len) of one site
+    struct Range {
+        int site;
+        uint64_t clock;
+        size_t len;
+    };
+
+    bool isnoop() const { return type == NOOP; }
+    string encode() const;
+    static bool decode(const string& message, SequenceOp& op);
+
+    Type type = NOOP;
+    SequenceId id;          // id of the first inserted character
+    SequenceId origin;      // the character the text goes after
+    string text;            // inserted text
+    vector<Range> ranges;   // erased characters
+};
+
+class Sequence : public TextModel {
+public:
+    static const int ROOT_SITE = -1;  // site of the loaded text
+    // runs stop growing here, lines are looked up inside a run linearly
+    static const size_t MAX_RUN = 1024;
+
+    explicit Sequence(int site_id = 0);
+    // disable copy constructor and assignment operator
+    Sequence(const Sequence& s) = delete;
+    Sequence& operator=(const Sequence& s) = delete;
+
+    // readers, same line view as a Document
+    size_t size() const override;
+    string operator[](size_t linenum) const;
+    string line(size_t linenum) const override { return (*this)[linenum]; }
+    string text() const;
+
+    // writers
+    // every replica has to load the same lines
+    void load(vector<string>&& lines) override;
+    // apply a local edit, returns the op to send to the other replicas
+    SequenceOp apply(const Operation& op);
+    void edit(const Operation& op) override { apply(op); }
+    // merge an op from another replica, in any order; applied gets the
+    // edits that became visible, ready to apply to a line based copy
+    void merge(const SequenceOp& op, vector<Operation>& applied);
+
+    int get_site() const { return site; }
+    uint64_t get_clock() const { return clock; }
+    size_t num_runs() const { return runs.size(); }
+    size_t num_waiting() const { return waiting.size(); }
+
+private:
+    struct Run {
+        SequenceId id;  // id of the first character, the i-th has clock + i
+        size_t len = 0;
+        string text;    // emptied once the run is erased
+        size_t newlines = 0;
+        bool deleted    = false;
+        unsigned priority;
+        Run* parent = nullptr;
+        Run* left   = nullptr;
+        Run* right  = nullptr;
+        size_t chars_sum    = 0;  // visible characters in the subtree
+        size_t newlines_sum = 0;  // visible newlines in the subtree
+    };
+
+    // treap maintenance
+    Run* new_run(const SequenceId& id, string&& text, bool deleted);
+    void update(Run* run);
+    void update_path(Run* run);
+    void rotate_up(Run* run);
+    void insert_after(Run* prev, Run* run);
+    static Run* next(Run* run);
+    static size_t chars(const Run* run);
+    static size_t lines(const Run* run);
+
+    // cut run in two before its at-th character, returns the second half
+    Run* split(Run* run, size_t at);
+    // run holding id, at gets its index in the run
+    Run* find(const SequenceId& id, size_t& at) const;
+    // run holding the visible character at offset
+    Run* find(size_t offset, size_t& at) const;
+    size_t line_start(size_t linenum) const;
+    size_t to_offset(const Position& p) const;
+    Position to_position(const Run* run, size_t at) const;
+
+    // the id an op is still waiting for, null when it can be applied
+    SequenceId missing(const SequenceOp& op) const;
+    void integrate(const SequenceOp& op, vector<Operation>* applied);
+    void erase(Run* run, vector<Operation>* applied);
+
+    int site;
+    uint64_t clock = 0;  // highest clock seen
+    unsigned seed  = 2463534242u;
+    Run* root      = nullptr;
+    std::deque<Run> runs;
+    // runs by site and clock of their first character
+    std::unordered_map<int, std::map<uint64_t, Run*>> index;
+    // ops waiting for the id they are keyed by
+    std::multimap<SequenceId, SequenceOp> waiting;
+};
+
+#endif
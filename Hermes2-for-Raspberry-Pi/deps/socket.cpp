@@ -1,13 +1,17 @@
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cinttypes>
 #include <cstring>
 #include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "socket.h"
 #include "util.h"
@@ -66,98 +70,100 @@ bool Socket::disconnect() {
 }
 
 ssize_t Socket::send(const string& message, int command_type) {
-    string encrypted;
+    std::lock_guard<std::recursive_mutex> guard(*send_mutex);
+    // the size goes out in the same write as the message, or Nagle holds
+    // the message back until the size is acknowledged
+    string encrypted(MESSAGE_SIZE_DIGITS, '\0');
     encrypted.push_back(static_cast<char>(command_type));
     encrypted.append(std::move(base64_encode(message)));
-    int32_t len = htonl(encrypted.size());
-    if(sen(reinterpret_cast<char*>(&len), MESSAGE_SIZE_DIGITS) < 0)
-        return -1;
+    int32_t len = htonl(encrypted.size() - MESSAGE_SIZE_DIGITS);
+    std::memcpy(&encrypted[0], &len, MESSAGE_SIZE_DIGITS);
     ssize_t retval = sen(encrypted);
-    PERROR("Sending " << encrypted << " of size " << ntohl(len));
-    return retval;
+    PERROR("Sending " << encrypted.substr(MESSAGE_SIZE_DIGITS) << " of size "
+                      << ntohl(len));
+    return retval < 0 ? retval : retval - ssize_t(MESSAGE_SIZE_DIGITS);
 }
 
-// ssize_t ClientSocket::broadcast(const string& message,
-//                                 const std::vector<int>& client_list,
-//                                 int command_type) {
-//     string encrypted;
-//     encrypted.push_back(static_cast<char>(command_type));
-//     encrypted.append(std::move(base64_encode(message)));
-//     int32_t len    = htonl(encrypted.size() - 1);
-//     ssize_t retval = 0;
-//     for(const int& s : client_list) {
-//         if(sen(reinterpret_cast<char*>(&len), MESSAGE_SIZE_DIGITS, s) < 0)
-//             return -1;
-//         retval = sen(encrypted, s);
-//         if(retval <= 0)
-//             return retval;
-//     }
-//     return retval;
-// }
-
-ssize_t ClientSocket::broadcast(const string& message, int command_type) {
-    if(!client_list)
-        return -1;
-    string encrypted;
-    encrypted.push_back(static_cast<char>(command_type));
-    encrypted.append(std::move(base64_encode(message)));
-    int32_t len    = htonl(encrypted.size());
-    ssize_t retval = static_cast<ssize_t>(len);
-    for(const auto& client : *client_list) {
-        if(&client == this || !client.isready || client.filename != filename ||
-           client.begloc > currloc || client.begloc + client.rownum < currloc)
+void ClientSocket::publish(const vector<Operation>& ops, bool echo) {
+    if(!client_list || ops.empty())
+        return;
+    string batch;  // encoded once for every client that needs all of ops
+    for(auto& client : *client_list) {
+        if(!client.isready || client.filename != filename)
             continue;
-        if(sen(reinterpret_cast<char*>(&len), MESSAGE_SIZE_DIGITS, client) < 0)
-            return -1;
-        retval = sen(encrypted, encrypted.size(), client);
-        if(retval <= 0)
-            return retval;
+        std::lock_guard<std::recursive_mutex> guard(client.get_send_mutex());
+        // the anchors are only moved once in a while, before they could
+        // no longer be placed
+        doc->refresh(client.begloc);
+        doc->refresh(client.currloc);
+        if(&client == this && !echo) {
+            client.send(std::to_string(ops.back().revision), C_ACK_OPS);
+            client.revision = ops.back().revision;
+            continue;
+        }
+        // skip what the client already got with its last snapshot, the
+        // rest goes out as one batch for the client to apply in one step
+        auto unseen = std::find_if(
+            ops.begin(), ops.end(), [&client](const Operation& op) {
+                return op.revision > client.revision;
+            });
+        if(unseen == ops.end())
+            continue;
+        if(unseen != ops.begin())
+            client.send(encode_batch(client.revision,
+                                     vector<Operation>(unseen, ops.end())),
+                        C_APPLY_OPS);
+        else {
+            if(batch.empty())
+                batch = encode_batch(ops.front().revision - 1, ops);
+            client.send(batch, C_APPLY_OPS);
+        }
+        client.revision = ops.back().revision;
     }
-    PERROR("Sending " << encrypted << " of size " << ntohl(len));
-    return retval;
 }
 
-
-string& ClientSocket::update_line(string&& line) {
-    if(!file_vec)
-        return line;
-    (*file_vec)[currloc].s = std::move(line);
-    return (*file_vec)[currloc].s;
+// publish() takes the send mutex with the write lock held, so anchors
+// are copied out and placed without holding the send mutex
+size_t ClientSocket::top() {
+    Document::Anchor first;
+    {
+        std::lock_guard<std::recursive_mutex> guard(*send_mutex);
+        first = begloc;
+    }
+    doc->locate(first);
+    std::lock_guard<std::recursive_mutex> guard(*send_mutex);
+    if(first.revision > begloc.revision)
+        begloc = first;
+    return first.line;
 }
 
-void ClientSocket::insert_line(const string& line) {
-    if(!file_vec)
-        return;
-    // + 1 since we are inserting before current location
-    (*file_vec).insert(file_vec->begin() + (++currloc), line);
+void ClientSocket::set_top(size_t line) {
+    std::lock_guard<std::recursive_mutex> guard(*send_mutex);
+    begloc = Document::Anchor(line, revision);
+}
 
-    // calculating new client locations
-    if(!client_list)
-        return;
-    for(auto& client : *client_list) {
-        if(&client == this || !client.isready || client.filename != filename ||
-           client.begloc < currloc)
-            continue;
-        ++client.begloc;
-        ++client.currloc;
-    }
+void ClientSocket::set_cursor(size_t line) {
+    std::lock_guard<std::recursive_mutex> guard(*send_mutex);
+    currloc = Document::Anchor(line, revision);
 }
 
-void ClientSocket::delete_line(size_t linenum) {
-    if(!file_vec || linenum > file_vec->size())
-        return;
-    (*file_vec).erase(file_vec->begin() + linenum);
-    currloc = linenum - 1;
-    // calculating new client locations
-    if(!client_list)
-        return;
-    for(auto& client : *client_list) {
-        if(&client == this || !client.isready || client.filename != filename ||
-           client.begloc < linenum)
-            continue;
-        --client.begloc;
-        --client.currloc;
+void ClientSocket::follow_cursor() {
+    Document::Anchor cursor, first;
+    {
+        std::lock_guard<std::recursive_mutex> guard(*send_mutex);
+        cursor = currloc;
+        first  = begloc;
     }
+    doc->locate(cursor);
+    doc->locate(first);
+    std::lock_guard<std::recursive_mutex> guard(*send_mutex);
+    if(cursor.line < first.line)
+        first = cursor;
+    else if(rownum && cursor.line >= first.line + rownum)
+        first = Document::Anchor(cursor.line + 1 - rownum, cursor.revision);
+    begloc = first;
+    if(cursor.revision > currloc.revision)
+        currloc = cursor;
 }
 
 ssize_t Socket::sen(const string& message, size_t len, int s) {
@@ -325,6 +331,9 @@ bool ServerSocket::accept(Socket& client) {
         PERROR("accept() fails.");
         return false;
     }
+    // replies streamed as several messages must not wait on each other
+    int nodelay = 1;
+    setsockopt(retval, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
     client.set_info(clientinfo);
     client.set_socket(retval);
     client.set_ip(inet_ntoa(clientinfo.sin_addr));
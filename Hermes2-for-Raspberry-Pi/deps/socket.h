@@ -8,9 +8,14 @@
 #include <climits>
 #include <cstring>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "document.h"
+#include "operation.h"
+#include "oplog.h"
 #include "util.h"
 
 using std::string;
@@ -33,6 +38,8 @@ public:
     const string& get_port() const { return port; }
     int get_socket() const { return socket; }
     bool isconnected() const { return is_connected; }
+    // hold it to send several messages without others in between
+    std::recursive_mutex& get_send_mutex() const { return *send_mutex; }
 
     // modification functions
     void set_socket(const int& _s) { socket = _s; }
@@ -70,6 +77,8 @@ protected:
     string port;
     bool is_connected = false;
     sockaddr_in info;
+    std::shared_ptr<std::recursive_mutex> send_mutex =
+        std::make_shared<std::recursive_mutex>();
 };
 
 class ServerSocket : public Socket {
@@ -100,26 +109,43 @@ private:
 
 class ClientSocket : public Socket {
 public:
-    // ssize_t broadcast(const string& message,
-    //                   const std::vector<int>& client_list,
-    //                   int command_type = C_OTHER);
-    ssize_t broadcast(const string& message, int command_type = C_OTHER);
-
-    ServerLineEntry& operator[](unsigned int i) { return (*file_vec)[i]; }
+    // reads go through a snapshot so they never race with writers
+    string operator[](size_t i) const { return (*doc->snapshot())[i]; }
     operator bool() const { return isready; }
-    string& update_line(string&& line);
-    void insert_line(const string& line);
-    void delete_line(size_t linenum);
+    // acknowledge ops applied to the document to their author and send
+    // them to every other client on the same file, as a single batch;
+    // with echo the author gets them too, as it did not make them itself
+    // (undo and redo)
+    void publish(const vector<Operation>& ops, bool echo = false);
+
+    // where the client's window starts now; this and follow_cursor() take
+    // the document's write lock, so not from a notify callback
+    size_t top();
+    // lines as of the last revision the client was sent
+    void set_top(size_t line);
+    void set_cursor(size_t line);
+    // move the window to hold the cursor, for rows the client scrolled in
+    // from its cache, which never came through C_PUSH_LINE_*
+    void follow_cursor();
 
     // public member variables
     string filename;
-    size_t begloc                     = 0;
     size_t rownum                     = ULONG_MAX;
-    size_t currloc                    = 0;
+    uint64_t revision                 = 0;  // last revision sent
     bool isediting                    = false;
     bool isready                      = false;
-    vector<ServerLineEntry>* file_vec = nullptr;
-    list<ClientSocket>* client_list   = nullptr;
+    bool watching                     = false;  // gets file list changes
+    // keep the open file loaded while the client is on it
+    std::shared_ptr<Document> doc;
+    std::shared_ptr<OpLog> log;
+    list<ClientSocket>* client_list = nullptr;
+
+private:
+    // The client's first row and cursor. Edits leave them alone until
+    // their revision is about to leave the document's history, see
+    // publish(). Guarded by the send mutex.
+    Document::Anchor begloc;
+    Document::Anchor currloc;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include <cctype>
+#include <cstring>
+#include <string>
+
+#include "syntax.h"
+
+using std::string;
+
+struct Syntax::Rules {
+    const char* const* extensions;
+    // a trailing '|' puts a keyword in the second set
+    const char* const* keywords;
+    const char* comment;      // single line comment start
+    const char* block_start;  // multi-line comment start
+    const char* block_end;
+};
+
+namespace {
+
+const char* const C_EXTENSIONS[] = {".c", ".h", ".cpp", ".hpp", ".cc",
+                                    nullptr};
+const char* const C_KEYWORDS[] = {
+    // a few C / C++ keywords
+    "switch", "if", "while", "for", "break", "continue", "return", "else",
+    "struct", "union", "typedef", "static", "enum", "class",
+    // C types
+    "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+    "void|", nullptr};
+
+const Syntax::Rules RULES[] = {
+    {C_EXTENSIONS, C_KEYWORDS, "//", "/*", "*/"},
+};
+
+bool is_separator(char c) {
+    return c == '\0' || std::isspace(static_cast<unsigned char>(c)) ||
+           std::strchr(",.()+-/*=~%[];", c);
+}
+
+// whether the two characters of token start line at i
+bool at(const string& line, size_t i, const char* token) {
+    return i + 1 < line.size() && line[i] == token[0] &&
+           line[i + 1] == token[1];
+}
+
+}  // namespace
+
+void Syntax::select(const string& filename) {
+    rules = nullptr;
+    for(const Rules& r : RULES) {
+        for(const char* const* ext = r.extensions; *ext; ++ext) {
+            size_t len = std::strlen(*ext);
+            if(filename.size() >= len &&
+               filename.compare(filename.size() - len, len, *ext) == 0) {
+                rules = &r;
+                return;
+            }
+        }
+    }
+}
+
+bool Syntax::highlight(const string& line, bool open, string& hl) const {
+    hl.assign(line.size(), NORMAL);
+    if(!rules)
+        return false;
+
+    size_t i = 0;
+    while(i < line.size() && std::isspace(static_cast<unsigned char>(line[i])))
+        ++i;
+    bool prev_sep   = true;  // whether i starts a word
+    char in_string  = 0;     // the quote of the string i is in, if any
+    bool in_comment = open;
+
+    while(i < line.size()) {
+        char c = line[i];
+        // unlike kilo a // inside a multi-line comment does not end it
+        if(!in_comment && prev_sep && at(line, i, rules->comment)) {
+            hl.replace(i, string::npos, line.size() - i, COMMENT);
+            return false;
+        }
+
+        if(in_comment) {
+            hl[i] = MLCOMMENT;
+            if(at(line, i, rules->block_end)) {
+                hl[i + 1] = MLCOMMENT;
+                i += 2;
+                in_comment = false;
+                prev_sep   = true;
+            } else {
+                ++i;
+                prev_sep = false;
+            }
+            continue;
+        } else if(at(line, i, rules->block_start)) {
+            hl[i] = hl[i + 1] = MLCOMMENT;
+            i += 2;
+            in_comment = true;
+            prev_sep   = false;
+            continue;
+        }
+
+        if(in_string) {
+            hl[i] = STRING;
+            if(c == '\\' && i + 1 < line.size()) {
+                hl[i + 1] = STRING;
+                i += 2;
+                prev_sep = false;
+                continue;
+            }
+            if(c == in_string)
+                in_string = 0;
+            ++i;
+            continue;
+        } else if(c == '"' || c == '\'') {
+            in_string = c;
+            hl[i++]   = STRING;
+            prev_sep  = false;
+            continue;
+        }
+
+        if(c != '\t' && !std::isprint(static_cast<unsigned char>(c))) {
+            hl[i++]  = NONPRINT;
+            prev_sep = false;
+            continue;
+        }
+
+        bool after_number = i > 0 && hl[i - 1] == NUMBER;
+        if((std::isdigit(static_cast<unsigned char>(c)) &&
+            (prev_sep || after_number)) ||
+           (c == '.' && after_number)) {
+            hl[i++]  = NUMBER;
+            prev_sep = false;
+            continue;
+        }
+
+        if(prev_sep) {
+            const char* const* kw = rules->keywords;
+            for(; *kw; ++kw) {
+                size_t len  = std::strlen(*kw);
+                bool second = (*kw)[len - 1] == '|';
+                if(second)
+                    --len;
+                if(line.compare(i, len, *kw, len) == 0 &&
+                   is_separator(i + len < line.size() ? line[i + len] : 0)) {
+                    hl.replace(i, len, len, second ? KEYWORD2 : KEYWORD1);
+                    i += len;
+                    break;
+                }
+            }
+            if(*kw) {
+                prev_sep = false;
+                continue;
+            }
+        }
+
+        prev_sep = is_separator(c);
+        ++i;
+    }
+    return in_comment;
+}
+
+int Syntax::pair(Type type) {
+    switch(type) {
+        case COMMENT:
+        case MLCOMMENT: return FIRST_PAIR;      // cyan
+        case KEYWORD1: return FIRST_PAIR + 1;   // yellow
+        case KEYWORD2: return FIRST_PAIR + 2;   // green
+        case STRING: return FIRST_PAIR + 3;     // magenta
+        case NUMBER: return FIRST_PAIR + 4;     // red
+        default: return 0;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef __SYNTAX_H__
+#define __SYNTAX_H__
+// Syntax highlighting, ported from editorUpdateSyntax in _files/kilo.c.
+//
+// A line is lexed on its own given one bit of state, whether it starts
+// inside a multi-line comment, and hands the same bit on to the line
+// after it. Keeping that bit for every row lets an edit re-lex its own
+// rows and then only the rows below whose starting state changed.
+#include <string>
+
+using std::string;
+
+class Syntax {
+public:
+    enum Type : char {
+        NORMAL = 0,
+        NONPRINT,
+        COMMENT,    // single line comment
+        MLCOMMENT,  // multi-line comment
+        KEYWORD1,
+        KEYWORD2,
+        STRING,
+        NUMBER,
+    };
+
+    // pick the rules by the file's name, none if it is not known
+    void select(const string& filename);
+    bool enabled() const { return rules; }
+
+    // Set hl to the type of every byte of line, starting inside a
+    // multi-line comment if open is set. Returns whether the line ends
+    // inside one.
+    bool highlight(const string& line, bool open, string& hl) const;
+
+    // color pair to draw a type with, 0 for the default colors; the
+    // client sets up pairs FIRST_PAIR and on
+    static int pair(Type type);
+    static const int FIRST_PAIR = 4;
+
+    struct Rules;
+
+private:
+    const Rules* rules = nullptr;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __TEXTMODEL_H__
+#define __TEXTMODEL_H__
+// What the two document models have in common: the text as lines, and
+// edits made by a local user at the model's current state.
+//
+// They differ in how concurrent edits meet. A Document is the server's
+// copy, which transforms ops made against an older revision past the ones
+// applied since (OT). A Sequence is a replica that merges the ops of other
+// replicas in any order (CRDT). Code that only reads and edits, like the
+// benchmark, takes either one.
+#include <string>
+#include <vector>
+
+#include "operation.h"
+
+using std::string;
+using std::vector;
+
+class TextModel {
+public:
+    virtual ~TextModel() = default;
+
+    // number of lines
+    virtual size_t size() const = 0;
+    virtual string line(size_t linenum) const = 0;
+
+    // every copy has to start from the same lines
+    virtual void load(vector<string>&& lines) = 0;
+    // apply op as made at the current state, clamped to the text
+    virtual void edit(const Operation& op) = 0;
+};
+
+#endif
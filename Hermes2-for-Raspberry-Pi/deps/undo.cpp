@@ -0,0 +1,129 @@
+#include <cinttypes>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "undo.h"
+
+using std::vector;
+using std::uint64_t;
+
+const size_t UndoHistory::MAX_BYTES;
+const uint64_t UndoHistory::GROUP_NS;
+
+// a keystroke: text typed into a line or characters erased from one
+static bool typing(const Operation& op) {
+    if(op.type == Operation::INSERT)
+        return op.text.find('\n') == string::npos;
+    return op.type == Operation::ERASE && op.from.line == op.to.line;
+}
+
+size_t UndoHistory::footprint(const Operation& op) {
+    return sizeof(Operation) + op.text.capacity();
+}
+
+void UndoHistory::record(const Operation& op,
+                         const Operation& inverse,
+                         uint64_t now,
+                         bool same_batch) {
+    if(op.isnoop())
+        return;
+    Stacks& stacks = authors[op.author];
+    while(!stacks.redo.empty())
+        drop(stacks.redo, false);
+    // only ops right after the group continue it, since the inverses
+    // apply one after another
+    Group* last = stacks.undo.empty() ? nullptr : &stacks.undo.back();
+    bool join   = last && last->revision + 1 == op.revision;
+    if(join && !same_batch) {
+        const Operation& prev = last->inverses.back();
+        // the inverse of typing is typing the other way
+        join = now - last->time < GROUP_NS && typing(op) && typing(prev) &&
+               prev.type != op.type;
+    }
+    if(!join) {
+        stacks.undo.emplace_back();
+        last = &stacks.undo.back();
+    }
+    size_t size = footprint(inverse);
+    last->inverses.push_back(inverse);
+    last->revision = op.revision;
+    last->time     = now;
+    last->bytes += size;
+    bytes += size;
+    trim();
+}
+
+void UndoHistory::push(int author,
+                       bool redo,
+                       vector<Operation>&& inverses,
+                       uint64_t revision) {
+    Group group;
+    for(const Operation& op : inverses)
+        group.bytes += footprint(op);
+    group.inverses = std::move(inverses);
+    group.revision = revision;
+    bytes += group.bytes;
+    Stacks& stacks = authors[author];
+    (redo ? stacks.redo : stacks.undo).push_back(std::move(group));
+    trim();
+}
+
+bool UndoHistory::pop(int author, bool redo, Group& group) {
+    auto iter = authors.find(author);
+    if(iter == authors.end())
+        return false;
+    std::deque<Group>& stack = redo ? iter->second.redo : iter->second.undo;
+    if(stack.empty())
+        return false;
+    group = std::move(stack.back());
+    stack.pop_back();
+    bytes -= group.bytes;
+    return true;
+}
+
+void UndoHistory::clear(int author) {
+    auto iter = authors.find(author);
+    if(iter == authors.end())
+        return;
+    for(std::deque<Group>* stack : {&iter->second.undo, &iter->second.redo})
+        for(const Group& group : *stack)
+            bytes -= group.bytes;
+    authors.erase(iter);
+}
+
+void UndoHistory::clear() {
+    authors.clear();
+    bytes = 0;
+}
+
+void UndoHistory::drop(std::deque<Group>& stack, bool front) {
+    if(front) {
+        bytes -= stack.front().bytes;
+        stack.pop_front();
+    } else {
+        bytes -= stack.back().bytes;
+        stack.pop_back();
+    }
+}
+
+void UndoHistory::trim() {
+    while(bytes > max_bytes) {
+        // the oldest group of any author, undo before redo
+        std::deque<Group>* oldest = nullptr;
+        for(bool redo : {false, true}) {
+            for(auto& entry : authors) {
+                auto& stack = redo ? entry.second.redo : entry.second.undo;
+                if(!stack.empty() &&
+                   (!oldest ||
+                    stack.front().revision < oldest->front().revision))
+                    oldest = &stack;
+            }
+            if(oldest)
+                break;
+        }
+        if(!oldest)
+            break;
+        drop(*oldest, true);
+    }
+}
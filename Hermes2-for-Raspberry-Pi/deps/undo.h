@@ -0,0 +1,73 @@
+#ifndef __UNDO_H__
+#define __UNDO_H__
+// Undo and redo history of a document, kept apart for every author.
+//
+// Each applied op is stored as its inverse, the op that takes it back.
+// Ops made one right after another, as when typing a word, join a single
+// group so one undo takes them all back. Undoing applies the inverses of
+// the last group on top of the revision it was made at; the document
+// transforms them past whatever other authors did since.
+//
+// The history of a document has a memory cap. Once over it, the oldest
+// groups go first, whoever made them.
+//
+// Not thread safe, the document guards it with its write lock.
+#include <cinttypes>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "operation.h"
+
+using std::vector;
+using std::uint64_t;
+
+class UndoHistory {
+public:
+    struct Group {
+        vector<Operation> inverses;  // in the order the ops were applied
+        uint64_t revision = 0;       // the inverses apply on top of it
+        uint64_t time     = 0;       // when the last op was added
+        size_t bytes      = 0;
+    };
+
+    explicit UndoHistory(size_t max = MAX_BYTES) : max_bytes(max) {}
+
+    // op was applied at op.revision and inverse takes it back; joins the
+    // last group of the author if it continues it, and clears its redo
+    void record(const Operation& op,
+                const Operation& inverse,
+                uint64_t now,
+                bool same_batch);
+    // add a group of inverses applied by an undo (to the redo stack) or
+    // by a redo (to the undo stack)
+    void push(int author, bool redo, vector<Operation>&& inverses,
+              uint64_t revision);
+    // take the last group off the undo or redo stack of author
+    bool pop(int author, bool redo, Group& group);
+    void clear(int author);
+    void clear();
+
+    size_t memory() const { return bytes; }
+
+    static const size_t MAX_BYTES = 1 << 20;
+    // typing pauses longer than this start a new group
+    static const uint64_t GROUP_NS = 1000000000;
+
+private:
+    struct Stacks {
+        std::deque<Group> undo;
+        std::deque<Group> redo;
+    };
+
+    static size_t footprint(const Operation& op);
+    // drop the oldest groups until under max_bytes
+    void trim();
+    void drop(std::deque<Group>& stack, bool front);
+
+    std::unordered_map<int, Stacks> authors;
+    size_t max_bytes;
+    size_t bytes = 0;
+};
+
+#endif
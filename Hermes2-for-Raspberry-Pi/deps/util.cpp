@@ -1,14 +1,24 @@
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
 
 #ifdef __MACH__
 #include <mach/clock.h>
 #include <mach/mach.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <algorithm>
+#include <cerrno>
 #include <cinttypes>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -171,4 +181,90 @@ string str_implode(const vector<string> &svec, char seperator) {
     }
     result += svec.back();
     return result;
-}
\ No newline at end of file
+}
+
+bool write_all(int fd, const string &data) {
+    size_t done = 0;
+    while(done < data.size()) {
+        ssize_t len = write(fd, data.c_str() + done, data.size() - done);
+        if(len < 0 && errno == EINTR)
+            continue;
+        if(len <= 0)
+            return false;
+        done += len;
+    }
+    return true;
+}
+
+void sync_directory(const string &path) {
+    size_t slash     = path.rfind('/');
+    string directory = slash == string::npos ? "." : path.substr(0, slash + 1);
+    int fd           = open(directory.c_str(), O_RDONLY);
+    if(fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+size_t find_substring(const char *text,
+                      size_t len,
+                      const string &needle,
+                      size_t from) {
+    const size_t n = needle.size();
+    if(from > len || len - from < n)
+        return string::npos;
+    if(n == 0)
+        return from;
+    const char *p = needle.data();
+    size_t i      = from;
+    // a block of 16 candidates is checked by comparing both the first and
+    // the last byte of the needle, and only the candidates matching both
+    // are compared in full
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(p[0]);
+    const __m128i last  = _mm_set1_epi8(p[n - 1]);
+    for(; n > 1 && i + n - 1 + 16 <= len; i += 16) {
+        __m128i head =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+        __m128i tail = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(text + i + n - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while(mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if(!std::memcmp(text + i + bit + 1, p + 1, n - 2))
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t first = vdupq_n_u8(p[0]);
+    const uint8x16_t last  = vdupq_n_u8(p[n - 1]);
+    const uint8_t *bytes   = reinterpret_cast<const uint8_t *>(text);
+    for(; n > 1 && i + n - 1 + 16 <= len; i += 16) {
+        uint8x16_t found = vandq_u8(vceqq_u8(vld1q_u8(bytes + i), first),
+                                    vceqq_u8(vld1q_u8(bytes + i + n - 1), last));
+        // narrow to four bits for each candidate
+        uint64_t mask = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(found), 4)),
+            0);
+        while(mask) {
+            unsigned bit = __builtin_ctzll(mask) / 4;
+            if(!std::memcmp(text + i + bit + 1, p + 1, n - 2))
+                return i + bit;
+            mask &= ~(uint64_t(0xF) << (bit * 4));
+        }
+    }
+#endif
+    // the tail, or all of it without SIMD
+    while(i + n <= len) {
+        const void *hit = std::memchr(text + i, p[0], len - n + 1 - i);
+        if(!hit)
+            break;
+        i = static_cast<const char *>(hit) - text;
+        if(!std::memcmp(text + i + 1, p + 1, n - 1))
+            return i;
+        ++i;
+    }
+    return string::npos;
+}
@@ -27,20 +27,31 @@ using std::endl;
 
 enum COMMAND_TYPES {
     C_NONE                 = 0,
+    // no longer sent, the client browses a page at a time
     C_GET_REMOTE_FILE_LIST = 65,
     C_RESPONSE_REMOTE_FILE_LIST,
     C_OPEN_FILE_REQUEST,
     C_RESPONSE_FILE_INFO,
     C_PUSH_LINE_FRONT,
     C_PUSH_LINE_BACK,
-    C_UPDATE_LINE_CONTENT,
     C_SET_CURSOR_POS,
     C_SWITCH_TO_BROWSING_MODE,
     C_SWITCH_TO_EDITING_MODE,
-    C_INSERT_LINE,
-    C_DELETE_LINE,
     C_SAVE_FILE,
     C_ADD_LINE_BACK,
+    C_APPLY_OPS,
+    C_ACK_OPS,
+    C_REQUEST_VIEWPORT,
+    C_GET_STATS,
+    C_UNDO,
+    C_REDO,
+    C_FILE_ADDED,
+    C_FILE_REMOVED,
+    C_BROWSE,
+    C_SEARCH,
+    C_FIND,
+    C_FETCH_LINES,
+    C_RESIZE_VIEWPORT,
     C_OTHER = 122,
 };
 
@@ -59,21 +70,14 @@ vector<string> get_file_list(const char* const base_directory);
 
 string str_implode(const vector<string>& svec, char seperator = '&');
 
-struct ClientLineEntry {
-    ClientLineEntry() = default;
-    ClientLineEntry(const string& line, size_t line_num = 0)
-        : linenum(line_num), s(line) {}
-    operator string&() { return s; }
-    size_t linenum;
-    string s;
-};
-
-struct ServerLineEntry {
-    ServerLineEntry() = default;
-    ServerLineEntry(const ServerLineEntry& other) : s(other.s) {}
-    ServerLineEntry(const string& line) : s(line) {}
-    operator string&() { return s; }
-    // std::mutex m;
-    string s;
-};
+// write the whole of data to fd, retrying short writes
+bool write_all(int fd, const string& data);
+// make a rename or creation of path durable
+void sync_directory(const string& path);
+// where needle first occurs in text[from, len), string::npos if nowhere;
+// compares 16 positions at a time where SSE2 or NEON is there
+size_t find_substring(const char* text,
+                      size_t len,
+                      const string& needle,
+                      size_t from = 0);
 #endif
\ No newline at end of file
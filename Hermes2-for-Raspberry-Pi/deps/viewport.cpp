@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "viewport.h"
+
+using std::string;
+using std::vector;
+
+void Viewport::reset(size_t top, size_t capacity) {
+    rows.resize(std::max(rows.size(), capacity));
+    start = count = 0;
+    first         = top;
+}
+
+void Viewport::grow() {
+    vector<string> larger(std::max<size_t>(2 * rows.size(), 16));
+    for(size_t row = 0; row < count; ++row)
+        larger[row] = std::move(rows[slot(row)]);
+    rows  = std::move(larger);
+    start = 0;
+}
+
+void Viewport::push_back(string&& line) {
+    if(count == rows.size())
+        grow();
+    rows[slot(count++)] = std::move(line);
+}
+
+void Viewport::push_front(string&& line) {
+    if(count == rows.size())
+        grow();
+    start = start ? start - 1 : rows.size() - 1;
+    ++count;
+    --first;
+    rows[start] = std::move(line);
+}
+
+void Viewport::pop_back() {
+    --count;
+}
+
+void Viewport::pop_front() {
+    start = slot(1);
+    --count;
+    ++first;
+}
+
+void Viewport::insert(size_t row, string&& line) {
+    if(count == rows.size())
+        grow();
+    ++count;
+    for(size_t i = count - 1; i > row; --i)
+        rows[slot(i)].swap(rows[slot(i - 1)]);
+    rows[slot(row)] = std::move(line);
+}
+
+void Viewport::erase(size_t row, size_t n) {
+    n = std::min(n, count - row);
+    for(size_t i = row; i + n < count; ++i)
+        rows[slot(i)].swap(rows[slot(i + n)]);
+    count -= n;
+}
@@ -0,0 +1,56 @@
+#ifndef __VIEWPORT_H__
+#define __VIEWPORT_H__
+// The rows of a file a client holds, kept in a ring.
+//
+// Only the line number of the first row is stored, so an edit never
+// renumbers the rows after it. Scrolling a line drops a row at one end
+// and adds one at the other, which only moves where the ring starts; the
+// storage is reused once the window is full.
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class Viewport {
+public:
+    // drop every row, the next one pushed is line top; room is made for
+    // capacity rows
+    void reset(size_t top, size_t capacity = 0);
+
+    size_t size() const { return count; }
+    bool empty() const { return !count; }
+    // line number of the first row, and one past the last row
+    size_t top() const { return first; }
+    size_t bottom() const { return first + count; }
+    void set_top(size_t top) { first = top; }
+
+    string& operator[](size_t row) { return rows[slot(row)]; }
+    const string& operator[](size_t row) const { return rows[slot(row)]; }
+    string& front() { return rows[slot(0)]; }
+    string& back() { return rows[slot(count - 1)]; }
+
+    // the line after the last row, or before the first one
+    void push_back(string&& line);
+    void push_front(string&& line);
+    void pop_back();
+    void pop_front();
+    // rows at and after row move down by one, or up by n
+    void insert(size_t row, string&& line);
+    void erase(size_t row, size_t n = 1);
+
+private:
+    size_t slot(size_t row) const {
+        size_t i = start + row;
+        return i < rows.size() ? i : i - rows.size();
+    }
+    // make room for another row
+    void grow();
+
+    vector<string> rows;
+    size_t start = 0;  // slot of the first row
+    size_t count = 0;
+    size_t first = 0;
+};
+
+#endif
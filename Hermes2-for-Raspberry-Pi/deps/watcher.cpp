@@ -0,0 +1,307 @@
+#include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "util.h"
+#include "watcher.h"
+
+using std::string;
+using std::vector;
+
+const size_t FileWatcher::MAX_THREADS;
+
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR;
+
+bool FileWatcher::start(const string& dir, const ChangeFunction& callback) {
+    stop();
+    root = dir;
+    if(root.empty() || root.back() != '/')
+        root.push_back('/');
+    on_change = callback;
+    // directories are watched before they are read, so nothing falls in
+    // between
+    inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        tree.clear();
+        watches.clear();
+    }
+    vector<string> found;
+    scan({""}, found);
+    if(inotify_fd < 0 || watches.empty()) {
+        PERROR("Failed to watch " << root);
+        return false;
+    }
+    stop_fd = ::eventfd(0, EFD_CLOEXEC);
+    thread  = std::thread(&FileWatcher::run, this);
+    return true;
+}
+
+void FileWatcher::stop() {
+    if(thread.joinable()) {
+        uint64_t one = 1;
+        if(::write(stop_fd, &one, sizeof(one)) < 0) {
+            PERROR("Failed to stop the watcher of " << root);
+        }
+        thread.join();
+    }
+    if(stop_fd >= 0)
+        ::close(stop_fd);
+    if(inotify_fd >= 0)
+        ::close(inotify_fd);
+    stop_fd = inotify_fd = -1;
+}
+
+vector<string> FileWatcher::list() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    vector<string> result;
+    // depth first, sorted listings give sorted paths
+    vector<std::pair<string, size_t>> stack = {{"", 0}};
+    while(!stack.empty()) {
+        auto iter = tree.find(stack.back().first);
+        if(iter == tree.end() || stack.back().second >= iter->second.size()) {
+            stack.pop_back();
+            continue;
+        }
+        string path = stack.back().first + iter->second[stack.back().second++];
+        if(path.back() == '/')
+            stack.emplace_back(std::move(path), 0);
+        else
+            result.push_back(std::move(path));
+    }
+    return result;
+}
+
+bool FileWatcher::browse(const string& dir,
+                         size_t offset,
+                         size_t count,
+                         vector<string>& page,
+                         size_t& total) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    page.clear();
+    auto iter = tree.find(dir);
+    if(iter == tree.end()) {
+        total = 0;
+        return false;
+    }
+    const vector<string>& entries = iter->second;
+    total                         = entries.size();
+    offset                        = std::min(offset, total);
+    page.assign(entries.begin() + offset,
+                entries.begin() + std::min(total, offset + count));
+    return true;
+}
+
+void FileWatcher::scan_one(const string& dir, vector<string>& subdirs) {
+    string path = root + dir;
+    int wd      = inotify_fd < 0 ? -1
+                            : ::inotify_add_watch(
+                                  inotify_fd, path.c_str(), WATCH_MASK);
+    vector<string> entries;
+    DIR* handle = ::opendir(path.c_str());
+    if(handle) {
+        struct dirent* entry;
+        while((entry = ::readdir(handle))) {
+            string name = entry->d_name;
+            if(name == "." || name == ".." ||
+               name.find('\n') != string::npos)
+                continue;
+            bool isdir = entry->d_type == DT_DIR;
+            if(entry->d_type == DT_UNKNOWN) {
+                struct stat info;
+                isdir = ::lstat((path + name).c_str(), &info) == 0 &&
+                        S_ISDIR(info.st_mode);
+            }
+            if(isdir) {
+                if(name[0] == '.')
+                    continue;  // hidden, like the server's own state
+                name.push_back('/');
+                subdirs.push_back(dir + name);
+            }
+            entries.push_back(std::move(name));
+        }
+        ::closedir(handle);
+    }
+    std::sort(entries.begin(), entries.end());
+    std::lock_guard<std::mutex> guard(mutex);
+    tree[dir] = std::move(entries);
+    if(wd >= 0)
+        watches[wd] = dir;
+}
+
+void FileWatcher::scan(const vector<string>& dirs, vector<string>& found) {
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<string> queue(dirs.begin(), dirs.end());
+    size_t busy = 0;  // directories being read
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        while(true) {
+            queue_cv.wait(lock, [&] { return !queue.empty() || !busy; });
+            if(queue.empty())
+                break;  // nothing left and nobody to add more
+            string dir = std::move(queue.front());
+            queue.pop_front();
+            ++busy;
+            lock.unlock();
+            vector<string> subdirs;
+            scan_one(dir, subdirs);
+            lock.lock();
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                for(const string& name : tree[dir])
+                    found.push_back(dir + name);
+            }
+            queue.insert(queue.end(), subdirs.begin(), subdirs.end());
+            --busy;
+            queue_cv.notify_all();
+        }
+    };
+    size_t num_threads = std::min<size_t>(
+        MAX_THREADS, std::max(2u, std::thread::hardware_concurrency()));
+    vector<std::thread> threads;
+    for(size_t i = 1; i < num_threads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for(std::thread& thread : threads)
+        thread.join();
+}
+
+void FileWatcher::forget(const string& dir, vector<string>& removed) {
+    auto iter = tree.find(dir);
+    if(iter == tree.end())
+        return;
+    vector<string> entries = std::move(iter->second);
+    tree.erase(iter);
+    for(auto watch = watches.begin(); watch != watches.end();) {
+        if(watch->second != dir) {
+            ++watch;
+            continue;
+        }
+        // a directory moved away would still be watched
+        ::inotify_rm_watch(inotify_fd, watch->first);
+        watch = watches.erase(watch);
+    }
+    for(const string& name : entries) {
+        if(name.back() == '/')
+            forget(dir + name, removed);
+        removed.push_back(dir + name);
+    }
+}
+
+void FileWatcher::rescan() {
+    std::unordered_set<string> before;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        for(const auto& entry : tree)
+            for(const string& name : entry.second)
+                before.insert(entry.first + name);
+        tree.clear();
+        watches.clear();
+    }
+    vector<string> found;
+    scan({""}, found);
+    for(const string& path : found)
+        // what was there before may have changed while events were lost
+        on_change(path, before.erase(path) ? MODIFIED : ADDED);
+    for(const string& path : before)
+        on_change(path, REMOVED);
+}
+
+void FileWatcher::handle(const string& dir, const string& name, uint32_t mask) {
+    string entry = name;
+    if(mask & IN_ISDIR) {
+        if(name[0] == '.')
+            return;
+        entry.push_back('/');
+    }
+    vector<string> changed;
+    bool added    = mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE);
+    bool modified = false;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto parent = tree.find(dir);
+        if(parent == tree.end())
+            return;
+        vector<string>& entries = parent->second;
+        auto iter = std::lower_bound(entries.begin(), entries.end(), entry);
+        bool present = iter != entries.end() && *iter == entry;
+        if(present && (mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) &&
+           !(mask & IN_ISDIR))
+            modified = true;  // written, or replaced by a rename
+        else if(present == added)
+            return;  // already known, seen while reading the directory
+        else if(added)
+            entries.insert(iter, entry);
+        else {
+            entries.erase(iter);
+            if(mask & IN_ISDIR)
+                forget(dir + entry, changed);
+        }
+    }
+    if(modified) {
+        on_change(dir + entry, MODIFIED);
+        return;
+    }
+    changed.push_back(dir + entry);
+    if(added && (mask & IN_ISDIR))
+        scan({dir + entry}, changed);
+    for(const string& path : changed)
+        on_change(path, added ? ADDED : REMOVED);
+}
+
+void FileWatcher::run() {
+    // large enough for a burst of events with long names
+    alignas(inotify_event) char buffer[16 * 1024];
+    pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+    while(true) {
+        if(::poll(fds, 2, -1) < 0)
+            continue;  // interrupted
+        if(fds[1].revents)
+            break;
+        ssize_t len;
+        while((len = ::read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+            for(char* curr = buffer; curr < buffer + len;) {
+                const inotify_event* event =
+                    reinterpret_cast<const inotify_event*>(curr);
+                curr += sizeof(inotify_event) + event->len;
+                if(event->mask & IN_Q_OVERFLOW) {
+                    PERROR("Lost events under " << root << ", rereading");
+                    rescan();
+                    continue;
+                }
+                string dir;
+                {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    auto iter = watches.find(event->wd);
+                    if(iter == watches.end())
+                        continue;
+                    if(event->mask & IN_IGNORED) {
+                        watches.erase(iter);
+                        continue;
+                    }
+                    dir = iter->second;
+                }
+                if(!event->len)
+                    continue;
+                string name(event->name);
+                if(name.find('\n') == string::npos)
+                    handle(dir, name, event->mask);
+            }
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef __WATCHER_H__
+#define __WATCHER_H__
+// An index of the directory tree under a path, kept up to date with
+// inotify.
+//
+// The tree is read once, by several threads at a time since a large tree
+// is mostly waiting on the disk. Afterwards every file or directory
+// created, moved or deleted updates its parent's sorted listing in place
+// and is reported as a change, so clients only get what changed. Files
+// written or replaced in place are reported too. The tree is only read
+// again if the kernel drops events.
+//
+// Paths are relative to the root and use '/'; directories end with '/'
+// in listings and changes. Hidden directories are left out.
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class FileWatcher {
+public:
+    enum Change { ADDED, REMOVED, MODIFIED };
+    // runs on the watcher thread once path was added to or removed from
+    // the index or its contents changed, one change at a time
+    typedef std::function<void(const string& path, Change change)>
+        ChangeFunction;
+
+    FileWatcher() = default;
+    // disable copy constructor and assignment operator
+    FileWatcher(const FileWatcher& w) = delete;
+    FileWatcher& operator=(const FileWatcher& w) = delete;
+    ~FileWatcher() { stop(); }
+
+    // read the tree under root and watch it, false if it cannot be
+    // watched (the index is still filled in then)
+    bool start(const string& root, const ChangeFunction& on_change);
+    void stop();
+
+    // every file, sorted
+    vector<string> list() const;
+    // count entries of dir starting at offset, false if there is no such
+    // directory; total gets the number of entries it has
+    bool browse(const string& dir,
+                size_t offset,
+                size_t count,
+                vector<string>& page,
+                size_t& total) const;
+
+    static const size_t MAX_THREADS = 8;  // for the first read
+
+private:
+    // read the directories under dirs, with threads if there are many;
+    // found gets every path read, parents first
+    void scan(const vector<string>& dirs, vector<string>& found);
+    // read one directory and watch it, subdirs gets its directories
+    void scan_one(const string& dir, vector<string>& subdirs);
+    // drop dir and what is under it, removed gets the paths dropped
+    void forget(const string& dir, vector<string>& removed);
+    void rescan();
+    void run();
+    void handle(const string& dir, const string& name, uint32_t mask);
+
+    string root;
+    ChangeFunction on_change;
+    int inotify_fd = -1;
+    int stop_fd    = -1;  // eventfd that wakes the thread up to stop
+    std::thread thread;
+    mutable std::mutex mutex;  // guards everything below
+    // sorted entries of every directory, "" being the root
+    std::unordered_map<string, vector<string>> tree;
+    std::unordered_map<int, string> watches;  // directory of each watch
+};
+
+#endif
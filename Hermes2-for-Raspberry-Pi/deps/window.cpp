@@ -1,6 +1,9 @@
 #include "window.h"
 #include <ncurses.h>
+#include <algorithm>
+#include <cstdlib>
 #include <string>
+#include <utility>
 #include <vector>
 using std::vector;
 using std::string;
@@ -16,6 +19,17 @@ bool Window::init(int h, int w, int starty, int startx) {
     return true;
 }
 
+void Window::resize(int h, int w, int starty, int startx) {
+    if(!is_init)
+        return;
+    // out of the way first, the window may not fit where it was
+    mvwin(win, 0, 0);
+    wresize(win, h, w);
+    mvwin(win, starty, startx);
+    max_row = h;
+    max_col = w;
+}
+
 void Window::printline(const string& line, int row, int col) {
     if(!is_init)
         return;
@@ -23,7 +37,6 @@ void Window::printline(const string& line, int row, int col) {
     wclrtoeol(win);
     wmove(win, row, col);
     waddnstr(win, line.c_str(), max_col);
-    wrefresh(win);
 }
 
 void Window::clear() {
@@ -32,157 +45,329 @@ void Window::clear() {
 }
 
 void StatusBar::print_filename(const string& file_name) {
+    filename_dirty = filename_dirty || file_name != filename;
+    filename       = file_name;
+}
+
+void StatusBar::print_status(const string& text) {
+    status_dirty = status_dirty || text != status;
+    status       = text;
+}
+
+void StatusBar::resize(int maxrow, int maxcol) {
+    Window::resize(2, maxcol, maxrow - 2, 0);
+    filename_dirty = status_dirty = true;
+}
+
+void StatusBar::draw() {
     if(!is_init)
         return;
-    wattron(win, A_REVERSE);  // print in reverse color
-    wmove(win, 0, 0);
-    wclrtoeol(win);
-    waddch(win, ' ');
-    waddnstr(win, file_name.c_str(), max_col);
-    for(size_t i = file_name.size() + 1; i < max_col; ++i)
+    if(filename_dirty) {
+        wattron(win, A_REVERSE);  // print in reverse color
+        wmove(win, 0, 0);
+        wclrtoeol(win);
         waddch(win, ' ');
-    wrefresh(win);
-    wattroff(win, A_REVERSE);
-    filename = file_name;
+        waddnstr(win, filename.c_str(), max_col);
+        for(size_t i = filename.size() + 1; i < max_col; ++i)
+            waddch(win, ' ');
+        wattroff(win, A_REVERSE);
+    }
+    if(status_dirty || filename_dirty)
+        Window::printline(status, 1, 1);
+    filename_dirty = status_dirty = false;
+    wnoutrefresh(win);
 }
 
-void StatusBar::print_status(const string& status) {
-    if(!is_init)
-        return;
-    Window::printline(status, 1, 1);
+void FileList::set_page(vector<string>&& page, size_t from, size_t size) {
+    entries = std::move(page);
+    first   = from;
+    total   = size;
+    // the listing may have shrunk under the selection
+    if(selected >= total)
+        selected = total ? total - 1 : 0;
+    if(!entries.empty() && !loaded(selected))
+        selected = selected < first ? first : first + entries.size() - 1;
 }
 
-void FileList::print_filelist(const vector<string>& file_list, ssize_t sel) {
-    size_t chosen;
-    if(sel == -1)
-        chosen = selected;
-    else
-        chosen     = sel;
-    size_t maxline = file_list.size() < max_row ? file_list.size() : max_row;
-    if(!is_init || chosen > maxline)
+void FileList::print_filelist() {
+    if(!is_init)
         return;
-
-
     curs_set(0);
     werase(win);
-    for(size_t i = 0; i < maxline; ++i) {
-        if(i != chosen)
-            mvwaddnstr(win, i, 0, file_list[i].c_str(), max_col);
+    for(size_t i = 0; i < entries.size() && i < max_row; ++i) {
+        if(first + i == selected)
+            wattron(win, A_REVERSE);
+        mvwaddnstr(win, i, 0, entries[i].c_str(), max_col);
+        wattroff(win, A_REVERSE);
     }
+}
 
-    // default is to select the first item
-    wattron(win, A_REVERSE);
-    mvwaddnstr(win, chosen, 0, file_list[chosen].c_str(), max_col);
-    wattroff(win, A_REVERSE);
-    selected = chosen;
+void FileList::draw() {
+    // painted by print_filelist(), under the lock that guards the page
+    if(is_init)
+        wnoutrefresh(win);
+}
 
-    wrefresh(win);
+bool FileList::scroll_up(size_t& wanted) {
+    if(!selected || !loaded(selected))
+        return true;  // at the top, or still waiting for a page
+    --selected;
+    if(loaded(selected)) {
+        print_filelist();
+        return true;
+    }
+    wanted = selected - selected % max_row;
+    return false;
 }
 
-void FileList::scroll_up(const vector<string>& file_list) {
-    if(selected == 0)
-        return;
-    print_filelist(file_list, --selected);
+bool FileList::scroll_down(size_t& wanted) {
+    if(selected + 1 >= total || !loaded(selected))
+        return true;
+    ++selected;
+    if(loaded(selected)) {
+        print_filelist();
+        return true;
+    }
+    wanted = selected - selected % max_row;
+    return false;
 }
 
-void FileList::scroll_down(const vector<string>& file_list) {
-    if(selected >= file_list.size() - 1)
-        return;
-    print_filelist(file_list, ++selected);
+string FileList::get_selected() const {
+    return loaded(selected) ? entries[selected - first] : "";
 }
 
-void FileContent::set_file_content(list<ClientLineEntry>* fc,
-                                   int row,
-                                   int col) {
+void FileContent::set_file_content(Viewport* fc, int row, int col) {
     file_content = fc;
-    currrow      = fc->begin();
     currrow_num  = row;
-    while(row--)
-        ++currrow;
-    currcol = col;
+    currcol      = col;
+    mark         = SIZE_MAX;
+    lexed.assign(max_row, RowSyntax());
+    top_open = false;
     wmove(win, row, col);
 }
 
-list<ClientLineEntry>::iterator FileContent::get_line(int row) {
-    auto ret = file_content->begin();
-    while(row--)
-        ++ret;
-    return ret;
+void FileContent::resize(int h, int w, size_t scrolled) {
+    touch(0, 0);
+    if(scrolled) {
+        top_open = lexed[std::min(scrolled, max_row) - 1].close;
+        currrow_num -= std::min(scrolled, currrow_num);
+    }
+    Window::resize(h, w, 0, 0);
+    refresh_file_content(-1);
 }
 
 void FileContent::refresh_file_content(int row) {
     if(row != -1) {
-        Window::printline(get_line(row)->s, row);
-        wmove(win, currrow_num, currcol);
-        wrefresh(win);
+        touch(row, row + 1);
         return;
     }
-    werase(win);
-    wmove(win, 0, 0);
-    for(const auto& l : *file_content)
-        mvwaddnstr(win, ++row, 0, l.s.c_str(), max_col);
-    wrefresh(win);
-    currrow = get_line(currrow_num);
-    if((currrow->s).size() < currcol) {
-        currcol = currrow->s.size();
+    touch(0, max_row);
+    clamp_cursor();
+}
+
+void FileContent::refresh_currrow() {
+    touch(currrow_num, currrow_num + 1);
+}
+
+void FileContent::scroll_rows(int n) {
+    size_t lines = std::abs(n);
+    if(!is_init || lines >= max_row) {
+        refresh_file_content(-1);
+        return;
+    }
+    // the terminal scrolls the region and only the rows it exposes are
+    // painted, however tall the window is
+    touch(0, 0);
+    scrollok(win, true);
+    wscrl(win, n);
+    scrollok(win, false);
+    if(n > 0) {
+        // the last row that went off the top hands its state on
+        top_open = lexed[lines - 1].close;
+        std::copy(dirty.begin() + lines, dirty.end(), dirty.begin());
+        shift_lexed(0, -n);
+        touch(max_row - lines, max_row);
+        clamp_cursor();
+        return;
+    }
+    std::copy_backward(dirty.begin(), dirty.end() - lines, dirty.end());
+    shift_lexed(0, -n);
+    touch(0, lines);
+    clamp_cursor();
+    if(!syntax.enabled())
+        return;
+    // The rows coming in at the top end in the state the old first row
+    // starts in. Lexing them upwards from there, a row starts in that
+    // same state unless that makes it end in the other one.
+    for(size_t row = std::min(lines, file_content->size()); row--;) {
+        if(lex_row(row, top_open) != top_open)
+            lex_row(row, !top_open);
+        top_open = lexed[row].open;
     }
-    wmove(win, currrow_num, currcol);
 }
 
-void FileContent::refresh_file_content(list<ClientLineEntry>::iterator& iter,
-                                       int row) {
-    Window::printline(iter->s, row);
-    wmove(win, currrow_num, currcol);
-    wrefresh(win);
+void FileContent::touch(size_t from, size_t to, bool changed) {
+    if(dirty.size() != max_row)
+        dirty.assign(max_row, true);
+    if(lexed.size() != max_row)
+        lexed.resize(max_row);
+    for(size_t row = from; row < to && row < max_row; ++row) {
+        dirty[row] = true;
+        lexed[row].stale |= changed;
+    }
 }
 
-void FileContent::refresh_file_content(const string& line, int row) {
-    Window::printline(line, row);
-    wmove(win, currrow_num, currcol);
-    wrefresh(win);
+void FileContent::shift_lexed(size_t row, int n) {
+    touch(0, 0);
+    row = std::min(row, max_row);
+    if(n > 0)
+        lexed.insert(lexed.begin() + row, n, RowSyntax());
+    else
+        lexed.erase(lexed.begin() + row,
+                    lexed.begin() + std::min(row + std::abs(n), max_row));
+    lexed.resize(max_row);
 }
 
-void FileContent::refresh_currrow() {
-    Window::printline(currrow->s, currrow_num);
-    wmove(win, currrow_num, currcol);
-    wrefresh(win);
+bool FileContent::lex_row(size_t row, bool open) {
+    RowSyntax& lex = lexed[row];
+    lex.close = syntax.highlight((*file_content)[row], open, lex.hl);
+    lex.open  = open;
+    lex.stale = false;
+    return lex.close;
+}
+
+void FileContent::lex_rows() {
+    if(!syntax.enabled() || !file_content)
+        return;
+    bool open = top_open;
+    for(size_t row = 0; row < file_content->size() && row < max_row; ++row) {
+        if(lexed[row].stale || lexed[row].open != open) {
+            lex_row(row, open);
+            dirty[row] = true;
+        }
+        open = lexed[row].close;
+    }
+}
+
+void FileContent::get_selection(size_t& first, size_t& last) const {
+    first = get_row();
+    last  = first + 1;
+    if(mark == SIZE_MAX)
+        return;
+    first = std::min(first, mark);
+    last  = std::max(last, mark + 1);
+}
+
+void FileContent::paint(size_t row) {
+    const string& line = (*file_content)[row];
+    size_t line_num    = file_content->top() + row;
+    bool selected = has_mark() && line_num >= painted_first &&
+                    line_num < painted_last;
+    if(selected) {
+        // across the whole row, so empty lines show too
+        wattron(win, A_REVERSE);
+        whline(win, ' ' | A_REVERSE, max_col);
+    }
+    if(!syntax.enabled()) {
+        waddnstr(win, line.c_str(), max_col);
+        wattroff(win, A_REVERSE);
+        return;
+    }
+    // one run of bytes of the same type at a time
+    const string& hl = lexed[row].hl;
+    size_t end       = std::min(line.size(), max_col);
+    for(size_t i = 0, j; i < end; i = j) {
+        for(j = i + 1; j < end && hl[j] == hl[i];)
+            ++j;
+        Syntax::Type type = static_cast<Syntax::Type>(hl[i]);
+        if(type == Syntax::NONPRINT) {
+            wattron(win, A_REVERSE);
+            for(size_t k = i; k < j; ++k) {
+                unsigned char c = line[k];
+                waddch(win, c <= 26 ? '@' + c : '?');
+            }
+            if(!selected)
+                wattroff(win, A_REVERSE);
+            continue;
+        }
+        int pair = Syntax::pair(type);
+        wattron(win, COLOR_PAIR(pair));
+        waddnstr(win, line.data() + i, j - i);
+        wattroff(win, COLOR_PAIR(pair));
+    }
+    wattroff(win, A_REVERSE);
+}
+
+void FileContent::clamp_cursor() {
+    if(isempty()) {
+        currrow_num = currcol = 0;
+        return;
+    }
+    currrow_num = std::min(currrow_num, file_content->size() - 1);
+    currcol     = std::min(currcol, get_currline().size());
+}
+
+void FileContent::draw() {
+    if(!is_init)
+        return;
+    touch(0, 0);
+    lex_rows();
+    size_t rows = file_content ? file_content->size() : 0;
+    // paint the rows that went in or out of the selection
+    size_t first = 0, last = 0;
+    if(has_mark() && !isempty())
+        get_selection(first, last);
+    if(rows && (first != painted_first || last != painted_last)) {
+        size_t top = file_content->top();
+        touch(std::max(std::min(first, painted_first), top) - top,
+              std::max(std::max(last, painted_last), top) - top);
+    }
+    painted_first = first;
+    painted_last  = last;
+    for(size_t row = 0; row < max_row; ++row) {
+        if(!dirty[row])
+            continue;
+        dirty[row] = false;
+        wmove(win, row, 0);
+        wclrtoeol(win);
+        if(row < rows)
+            paint(row);
+    }
+    if(!isempty())
+        wmove(win, currrow_num, currcol);
+    wnoutrefresh(win);
 }
 
 int FileContent::scroll_up() {
     if(currrow_num == 0) {
-        if(currrow->linenum)
+        if(file_content->top())
             return -1;  // ask to retieve the line before
         else
             return -2;  // we are at the front of file
     }
-    --currrow;  // move back a line
-    if((currrow->s).size() < currcol) {
-        currcol = currrow->s.size();
-    }
-    wmove(win, --currrow_num, currcol);
+    --currrow_num;  // move back a line
+    currcol = std::min(currcol, get_currline().size());
+    wmove(win, currrow_num, currcol);
     return 1;
 }
 
 int FileContent::scroll_down() {
     if(currrow_num == max_row - 1) {
-        if(currrow->linenum == num_file_lines)
+        if(get_row() + 1 >= num_file_lines)
             return -2;
         else
             return -1;  // ask to retieve the line after
     }
-    if(++currrow == file_content->end()) {
-        --currrow;
+    if(currrow_num + 1 >= file_content->size())
         return -2;
-    }
-    if((currrow->s).size() < currcol) {
-        currcol = currrow->s.size();
-    }
-    wmove(win, ++currrow_num, currcol);
+    ++currrow_num;
+    currcol = std::min(currcol, get_currline().size());
+    wmove(win, currrow_num, currcol);
     return 1;
 }
 
 int FileContent::scroll_right() {
-    if(currcol >= max_col || currcol == currrow->s.size())
+    if(currcol >= max_col || currcol == get_currline().size())
         return 0;
     wmove(win, currrow_num, ++currcol);
     return 1;
@@ -196,144 +381,171 @@ int FileContent::scroll_left() {
     return 1;
 }
 
-void FileContent::insertchar(const char& c) {
-    if(currcol > max_col || currcol > currrow->s.size())
-        return;
-    currrow->s.insert(currrow->s.begin() + currcol, c);
+bool FileContent::insertchar(const char& c) {
+    string& line = (*file_content)[currrow_num];
+    if(currcol > max_col || currcol > line.size())
+        return false;
+    line.insert(line.begin() + currcol, c);
     refresh_currrow();
-    wmove(win, currrow_num, ++currcol);
+    ++currcol;
+    return true;
 }
 
-void FileContent::delchar() {
-    if(currrow->s.empty() || currcol == 0)
-        return;
-    if(currrow->s.size() < currcol) {
+bool FileContent::delchar() {
+    string& line = (*file_content)[currrow_num];
+    if(currcol == 0) {
+        // join the line onto the one before, if that is in the window
+        if(currrow_num == 0)
+            return false;
+        string& prev = (*file_content)[currrow_num - 1];
+        currcol      = prev.size();
+        prev += line;
+        file_content->erase(currrow_num);
+        shift_lexed(currrow_num, -1);
+        touch(currrow_num - 1, currrow_num);
+        touch(currrow_num--, max_row, false);
+        --num_file_lines;
+        return true;
+    }
+    if(line.size() < currcol) {
         PERROR("delete character past end of line");
-        return;
+        return false;
     }
     --currcol;
-    currrow->s.erase(currrow->s.begin() + currcol);
+    line.erase(line.begin() + currcol);
     refresh_currrow();
-    wmove(win, currrow_num, currcol);
-}
-
-void FileContent::add_line() {
-    // prevent client fro inserting new line at the end
-    // of editor
-    if(!file_content || currrow_num == max_row - 1)
-        return;
-    // the contents in original line is splited based on
-    // currcol
-    string temp(currrow->s.begin() + currcol, currrow->s.end());
-    currrow->s.erase(currrow->s.begin() + currcol, currrow->s.end());
-    Window::printline(currrow->s, currrow_num);
-    auto iter = currrow;
-    currrow =
-        file_content->emplace(++iter, std::move(temp), currrow->linenum + 1);
-    ++currrow_num;
-    Window::printline(currrow->s, currrow_num);
-    if(file_content->size() > max_row)
-        file_content->pop_back();
-    iter = currrow;
-    ++iter;  // in case iter get pop out
-    int y = currrow_num + 1;
-
-    currcol = 0;
-    while(iter != file_content->end()) {
-        Window::printline(iter->s, y);
-        ++(iter->linenum);
-        ++iter;
-        ++y;
-    }
-    // refresh entire file
-    // refresh_file_content(-1);
-
-    wmove(win, currrow_num, currcol);
+    return true;
 }
 
-void FileContent::insert_line(const string& s, size_t linenum) {
-    if(!file_content)
-        return;
+bool FileContent::add_line() {
+    if(!file_content || max_row < 2)
+        return false;
     // the contents in original line is splited based on
     // currcol
-    auto iter = file_content->begin();
-    size_t y  = 0;
-    for(; iter != file_content->end(); ++iter, ++y) {
-        if(iter->linenum == linenum) {
-            (file_content)->emplace(iter, s, linenum);
-            break;
-        }
-    }
-    for(; iter != file_content->end(); ++iter) {
-        ++(iter->linenum);
+    string& line = (*file_content)[currrow_num];
+    string temp(line.begin() + currcol, line.end());
+    line.erase(line.begin() + currcol, line.end());
+    if(currrow_num == max_row - 1) {
+        // on the last row the window scrolls down a line to keep the
+        // cursor in it
+        file_content->pop_front();
+        --currrow_num;
+        scroll_rows(1);
     }
+    // the rows below move down, their line numbers with them
+    shift_lexed(currrow_num + 1, 1);
+    touch(currrow_num, currrow_num + 2);
+    touch(currrow_num + 2, max_row, false);
+    file_content->insert(++currrow_num, std::move(temp));
     if(file_content->size() > max_row)
         file_content->pop_back();
+    currcol = 0;
     ++num_file_lines;
-    // refresh entire file
-    refresh_file_content(-1);
-    if(currrow_num <= y)
-        ++currrow_num;
-    wmove(win, currrow_num, currcol);
-    wrefresh(win);
+    return true;
 }
 
 ssize_t FileContent::del_line() {
-    if(!file_content || currrow_num == 0 || file_content->size() == 1)
+    if(!file_content || file_content->size() == 1)
         return -1;
-    currrow = file_content->erase(currrow);
-    for(auto iter = currrow; iter != file_content->end(); ++iter)
-        --(iter->linenum);
-    --currrow;
-    --currrow_num;
+    file_content->erase(currrow_num);
+    shift_lexed(currrow_num, -1);
+    touch(currrow_num, max_row, false);
+    // onto the line before, or the one after on the first row
+    if(currrow_num)
+        --currrow_num;
     --num_file_lines;
     currcol = 0;
-    if(num_file_lines > max_row - 1 + file_content->front().linenum)
-        return 1;
-    refresh_file_content(-1);
     return 0;
 }
 
-ssize_t FileContent::delete_line(size_t linenum) {
-    if(!file_content)
-        return -1;
-    int r, c;
-    getyx(win, r, c);
-    auto iter = file_content->begin();
-    for(; iter != file_content->end(); ++iter) {
-        if(iter->linenum == linenum) {
-            if(currrow == iter) {
-                currrow = file_content->erase(iter);
-                iter    = currrow;
-            } else
-                iter = file_content->erase(iter);
-            break;
+size_t FileContent::apply(const Operation& op, bool local) {
+    if(!file_content || op.isnoop())
+        return 0;
+    size_t first, last, count;
+    op.line_effect(first, last, count);
+    num_file_lines = num_file_lines + count - (last - first);
+    Position cursor(get_top() + currrow_num, currcol);
+    cursor = transform(cursor, op, local);
+    if(has_mark())
+        mark = transform(Position(mark, 0), op, local).line;
+
+    size_t top    = get_top();
+    size_t bottom = top + file_content->size();
+    if(last <= top) {
+        // above the window, only the line numbers move
+        top = top + count - (last - first);
+    } else if(first >= bottom) {
+        // below the window, nothing to do
+    } else if(first >= top && last <= bottom) {
+        // every line the op rewrites is on screen, only the rows from
+        // there on change, and only those it rewrites if it keeps the
+        // number of lines
+        size_t row = first - top;
+        if(count != last - first) {
+            shift_lexed(row, -static_cast<int>(last - first));
+            shift_lexed(row, count);
+            touch(row + count, max_row, false);
+        }
+        touch(row, row + count);
+        vector<string> old_lines;
+        for(size_t i = row; i < last - top; ++i)
+            old_lines.push_back(std::move((*file_content)[i]));
+        file_content->erase(row, last - first);
+        for(string& line : op.apply(old_lines))
+            file_content->insert(row++, std::move(line));
+    } else {
+        touch(0, max_row);
+        // the op reaches past the window, drop the rows that can no
+        // longer be rebuilt here and let them be fetched again
+        if(last > bottom) {
+            while(file_content->size() > std::max(first, top) - top)
+                file_content->pop_back();
+        }
+        if(first < top) {
+            while(!file_content->empty() && file_content->top() < last)
+                file_content->pop_front();
+            top = file_content->empty() ? first : first + count;
         }
     }
-    for(; iter != file_content->end(); ++iter)
-        --(iter->linenum);
-    if(num_file_lines > max_row - 1 + file_content->front().linenum)
-        return 1;
-    refresh_file_content(-1);
-    set_pos(r - 1, c);
-    wrefresh(win);
-    return 0;
+    while(file_content->size() > max_row)
+        file_content->pop_back();
+    file_content->set_top(top);
+
+    if(file_content->empty()) {
+        currrow_num = currcol = 0;
+        return missing_rows();
+    }
+    // keep the cursor on the same text when possible
+    if(cursor.line < top)
+        currrow_num = 0;
+    else
+        currrow_num = std::min(cursor.line - top, file_content->size() - 1);
+    currcol = std::min(cursor.col, get_currline().size());
+    return missing_rows();
+}
+
+size_t FileContent::get_top() const {
+    return file_content ? file_content->top() : 0;
+}
+
+size_t FileContent::missing_rows() const {
+    if(!file_content)
+        return 0;
+    size_t top    = get_top();
+    size_t wanted = num_file_lines > top ? num_file_lines - top : 0;
+    wanted        = std::min(wanted, max_row);
+    return wanted > file_content->size() ? wanted - file_content->size() : 0;
 }
 
 void FileContent::set_pos(int row, int col) {
-    currrow     = get_line(row);
     currrow_num = row;
-    if(static_cast<int>(currrow->s.size()) < col)
-        currcol = currrow->s.size();
+    if(static_cast<int>(get_currline().size()) < col)
+        currcol = get_currline().size();
     else
         currcol = col;
     wmove(win, currrow_num, currcol);
-    wrefresh(win);
 }
 
 const string& FileContent::get_prevline() const {
-    if(!file_content || currrow == file_content->begin())
-        return currrow->s;
-    auto iter = currrow;
-    return (--iter)->s;
+    return (*file_content)[currrow_num ? currrow_num - 1 : 0];
 }
\ No newline at end of file
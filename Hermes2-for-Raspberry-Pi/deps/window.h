@@ -4,7 +4,10 @@
 #include <list>
 #include <string>
 #include <vector>
+#include "operation.h"
+#include "syntax.h"
 #include "util.h"
+#include "viewport.h"
 using std::vector;
 using std::list;
 using std::string;
@@ -21,7 +24,10 @@ public:
     Window& operator=(const Window& s) = delete;
 
     bool init(int h, int w, int starty, int startx);
+    // fit the window to a resized terminal, it is painted anew
+    void resize(int h, int w, int starty, int startx);
 
+    // draw into the window, it reaches the screen with the next frame
     void printline(const string& line, int row, int col = 0);
     void clear();
 
@@ -53,25 +59,53 @@ public:
     bool init(int maxrow, int maxcol) {
         return Window::init(2, maxcol, maxrow - 2, 0);
     }
+    void resize(int maxrow, int maxcol);
 
     void print_filename(const string& file_name);
     void print_status(const string& status);
+    // paint the rows changed since the last frame and stage the window
+    // for doupdate(), leaving the cursor after the status
+    void draw();
 
     string get_filename() const { return filename; }
 
 private:
     string filename;
+    string status;
+    bool filename_dirty = false;
+    bool status_dirty   = false;
 };
 
+// One directory of the server, shown a page at a time. Only the page
+// holding the selection is loaded; moving off it asks for the next one.
 class FileList : public Window {
 public:
-    void print_filelist(const vector<string>& file_list, ssize_t sel = -1);
-    void scroll_up(const vector<string>& file_list);
-    void scroll_down(const vector<string>& file_list);
-
-    int get_selection() const { return selected; }
+    // entries [first, first + entries.size()) of a listing of total
+    void set_page(vector<string>&& entries, size_t first, size_t total);
+    // paint the page, it reaches the screen with the next frame
+    void print_filelist();
+    // stage the window for doupdate()
+    void draw();
+    // move the selection, false if it moved onto a page that is not
+    // loaded, wanted gets where that page starts
+    bool scroll_up(size_t& wanted);
+    bool scroll_down(size_t& wanted);
+    void select(size_t i) { selected = i; }
+
+    size_t get_selection() const { return selected; }
+    // the selected entry, empty while its page is being fetched
+    string get_selected() const;
+    size_t get_page_size() const { return max_row; }
+    size_t get_first() const { return first; }
 
 private:
+    bool loaded(size_t i) const {
+        return i >= first && i < first + entries.size();
+    }
+
+    vector<string> entries;  // the loaded page
+    size_t first    = 0;
+    size_t total    = 0;
     size_t selected = 0;
 };
 
@@ -79,39 +113,97 @@ class FileContent : public Window {
 public:
     // init
     void set_num_file_lines(const size_t& i) { num_file_lines = i; }
-    void set_file_content(list<ClientLineEntry>* fc, int row = 0, int col = 0);
+    void set_file_content(Viewport* fc, int row = 0, int col = 0);
     void set_pos(int row, int col);
+    // the terminal was resized, and the first scrolled rows were dropped
+    // to keep the cursor in the window
+    void resize(int h, int w, size_t scrolled);
+    // highlight the file by its name, if its type is known
+    void set_syntax(const string& filename) { syntax.select(filename); }
+    // the lines from the mark to the cursor's are selected, and move with
+    // the edits like the cursor does
+    void set_mark(size_t line) { mark = line; }
+    void clear_mark() { mark = SIZE_MAX; }
+    bool has_mark() const { return mark != SIZE_MAX; }
+    // selected lines [first, last), the cursor's line alone without a mark
+    void get_selection(size_t& first, size_t& last) const;
 
     int scroll_up();
     int scroll_down();
     int scroll_right();
     int scroll_left();
 
-    // modifying member function
-    void insertchar(const char& c);  // insert character at current position
-    void delchar();
-    void add_line();
-    void insert_line(const string& s, size_t linenum);
+    // modifying member function, false if nothing changed
+    bool insertchar(const char& c);  // insert character at current position
+    bool delchar();
+    bool add_line();
     ssize_t del_line();
-    ssize_t delete_line(size_t linenum);
+    // apply an op from another client, or a local one that leaves the
+    // cursor behind its text, returns the number of rows that have to be
+    // fetched from the server to fill the window again
+    size_t apply(const Operation& op, bool local = false);
 
-    void refresh_file_content(int row = -1);  // row = -1 -> refresh entire file
-    void refresh_file_content(list<ClientLineEntry>::iterator& iter, int row);
-    void refresh_file_content(const string& line, int row);
+    // mark a row to be painted with the next frame, row = -1 -> all rows
+    void refresh_file_content(int row = -1);
     void refresh_currrow();
+    // the window moved n lines down (up if negative), shift the rows on
+    // the screen instead of painting them all again
+    void scroll_rows(int n);
+    // paint the marked rows and stage the window for doupdate(), so a
+    // frame only sends the rows that changed
+    void draw();
 
     // accessing operators
-    list<ClientLineEntry>::iterator get_line(int row);
-    const string& get_currline() const { return currrow->s; }
+    const string& get_currline() const { return (*file_content)[currrow_num]; }
     const string& get_prevline() const;
-    size_t get_row() const { return currrow->linenum; }
+    size_t get_row() const { return file_content->top() + currrow_num; }
+    size_t get_col() const { return currcol; }
+    size_t get_num_file_lines() const { return num_file_lines; }
+    bool isempty() const { return !file_content || file_content->empty(); }
+    // line number of the first row
+    size_t get_top() const;
+    // rows below the last one that the file could fill
+    size_t missing_rows() const;
 
     bool isediting = false;
     // vector<bool> other_status_vec;
 
 private:
-    list<ClientLineEntry>* file_content;
-    list<ClientLineEntry>::iterator currrow;
+    // How far a row has been lexed. A row is lexed again only when its
+    // line changed or the row above now ends in another state, so the
+    // lexing after an edit stops at the first row that ends as before.
+    struct RowSyntax {
+        string hl;           // Syntax::Type of every byte
+        bool open  = false;  // lexed as starting inside a comment
+        bool close = false;  // ends inside a comment
+        bool stale = true;   // its line changed since
+    };
+
+    // mark rows [from, to) to be painted, and lexed again if their lines
+    // changed rather than moved
+    void touch(size_t from, size_t to, bool changed = true);
+    // the rows from row on moved n rows down, or up if n is negative,
+    // taking how they were lexed with them
+    void shift_lexed(size_t row, int n);
+    // lex row as starting inside a comment if open, returns its end state
+    bool lex_row(size_t row, bool open);
+    // lex the rows that need it, marking the ones that change
+    void lex_rows();
+    void paint(size_t row);
+    // keep the cursor on a row and column that exist
+    void clamp_cursor();
+
+    Viewport* file_content = nullptr;
+    vector<bool> dirty;  // by row, painted by the next draw()
+    Syntax syntax;
+    vector<RowSyntax> lexed;  // by row, like dirty
+    // Whether the first row starts inside a comment. Nothing above the
+    // window is ever lexed: this is carried over from the row scrolled
+    // off the top, and taken to be false when the window is set anew.
+    bool top_open = false;
+    size_t mark = SIZE_MAX;
+    // the selected lines as they were painted last
+    size_t painted_first = 0, painted_last = 0;
     size_t currrow_num;
     size_t currcol;
     size_t num_file_lines;
@@ -2,11 +2,14 @@
 // Hermes server
 #include <ncurses.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <chrono>
 #include <condition_variable>
 #include <csignal>
 #include <cstdlib>
@@ -14,18 +17,25 @@
 #include <functional>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <queue>
-// #include <sstream>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "document.h"
+#include "operation.h"
+#include "oplog.h"
+#include "saver.h"
+#include "search.h"
 #include "server.h"
 #include "socket.h"
 #include "util.h"
+#include "watcher.h"
 
 // added!! 
 using std::min;
@@ -43,11 +53,30 @@ using std::vector;
 // use filename as index
 // key "~" means the given client has not chose a file yet
 std::list<ClientSocket> client_list;
-std::unordered_map<string, vector<ServerLineEntry>> file_map;
+std::unordered_map<string, OpenFile> file_map;
 std::mutex client_list_mutex;
 std::mutex file_map_mutex;
-vector<string> file_list;
+Saver saver;  // writes files so no client thread waits for the disk
+// autosave, a file is saved once its oldest unsaved edit is
+// autosave_interval seconds old or it has autosave_edits unsaved edits;
+// autosave writes at most autosave_rate KB per second
+unsigned autosave_interval = 30;  // 0 turns autosave off
+unsigned autosave_edits    = 500;
+unsigned autosave_rate     = 512;  // 0 writes at full speed
+// files no client is on are unloaded, oldest first, while the loaded ones
+// take more than memory_budget MB
+unsigned memory_budget = 64;  // 0 keeps every file loaded
+// a file whose log holds this many edits gets a checkpoint, so restarting
+// replays at most that many
+const uint64_t checkpoint_edits = 2000;
+// matches of a search in a document go out this many at a time
+const size_t find_batch = 256;
+// the most lines a client can read ahead in one C_FETCH_LINES
+const size_t max_block = 1024;
+FileWatcher file_watcher;  // files under base_directory
+SearchIndex search_index;  // trigrams of the same files
 string base_directory;
+const string log_directory = ".hermes/";  // inside base_directory
 ServerSocket self;
 volatile std::sig_atomic_t running = 1;
 void int_handler(int sig) {
@@ -60,7 +89,11 @@ int main(int argc, char** argv) {
     if(argc < 2) {
         cerr << "Usage: " << argv[0]
              << " [port number = 12345] [max clients = 10]\n"
-             << "                 [file path = ./_files/]" << endl;
+             << "                 [file path = ./_files/]\n"
+             << "                 [autosave seconds = 30] [autosave edits = "
+                "500]\n"
+             << "                 [autosave KB/s = 512] [memory MB = 64]"
+             << endl;
         self.set_port("12345");
     } else
         self.set_port(argv[1]);
@@ -89,11 +122,30 @@ int main(int argc, char** argv) {
     else
         base_directory = "./_files/";
 
-    file_list = std::move(get_file_list(base_directory.c_str()));
+    unsigned* settings[] = {
+        &autosave_interval, &autosave_edits, &autosave_rate, &memory_budget};
+    for(int i = 4; i < argc && i < 8; ++i) {
+        for(int j = 0; argv[i][j]; ++j)
+            if(!std::isdigit(argv[i][j])) {
+                cerr << "Autosave and memory settings must be numbers."
+                     << endl;
+                return 1;
+            }
+        *settings[i - 4] = std::atoi(argv[i]);
+    }
+
+    file_watcher.start(base_directory, file_list_changed);
+    search_index.start(base_directory, [](const string& filename) {
+        std::lock_guard<std::mutex> guard(file_map_mutex);
+        auto iter = file_map.find(filename);
+        return iter == file_map.end() ? nullptr : iter->second.doc->snapshot();
+    });
+    for(const string& filename : file_watcher.list())
+        search_index.update(filename);
 
 #ifdef DEBUG
     cout << "Avaliable files:\n------------\n";
-    for(const string& s : file_list)
+    for(const string& s : file_watcher.list())
         cout << s << '\n';
     cout << "------------" << endl;
 #endif
@@ -101,7 +153,19 @@ int main(int argc, char** argv) {
     self.connect();
     cout << "Server established on port " << self.get_port() << endl;
 
+    saver.start();
+    std::thread autosave_thread(autosave);
     int retval = run_server();
+    autosave_thread.join();
+    file_watcher.stop();
+    search_index.stop();
+    saver.stop();
+
+    // make sure every logged edit is on disk
+    file_map_mutex.lock();
+    for(auto& entry : file_map)
+        entry.second.log->close();
+    file_map_mutex.unlock();
 
     // use \r to overwrite potential escape character
     cout << "\rClosing Hermes server...\n"
@@ -159,48 +223,90 @@ void message_handler(size_t clientId) {
                           << " from client "
                           << clientId);
         switch(command) {
-            case C_GET_REMOTE_FILE_LIST: {
-                cout << "Sending file list to client " << clientId << endl;
-                // sending number of files
-                client.send(to_string(file_list.size()),
-                            C_RESPONSE_REMOTE_FILE_LIST);
-                // sending each file
-                for(const string& filename : file_list)
-                    client.send(filename);
+            case C_BROWSE: {
+                // "offset count dir", answered with "total offset dir"
+                // and a page of the entries of dir, one per line
+                std::istringstream in(message);
+                size_t offset = 0, count = 0;
+                in >> offset >> count;
+                in.get();
+                string dir;
+                std::getline(in, dir);
+                // a change to the tree is sent under the same lock after
+                // the watcher took it in, so it is either in the page or
+                // follows it; reading the page first could miss it
+                std::lock_guard<std::mutex> guard(client_list_mutex);
+                vector<string> page;
+                size_t total;
+                file_watcher.browse(dir, offset, count, page, total);
+                string reply = to_string(total) + ' ' + to_string(offset) +
+                               ' ' + dir + '\n';
+                for(const string& entry : page) {
+                    reply += entry;
+                    reply.push_back('\n');
+                }
+                client.send(reply, C_BROWSE);
+                client.watching = true;
+                break;
+            }
+            case C_SEARCH: {
+                // "offset count text", answered with "total offset" and a
+                // page of matches, "line col path" one per line
+                std::istringstream in(message);
+                size_t offset = 0, count = 0;
+                in >> offset >> count;
+                in.get();
+                string text;
+                std::getline(in, text);
+                vector<SearchIndex::Match> page;
+                size_t total;
+                search_index.search(text, offset, count, page, total);
+                string reply =
+                    to_string(total) + ' ' + to_string(offset) + '\n';
+                for(const SearchIndex::Match& match : page)
+                    reply += to_string(match.line) + ' ' +
+                             to_string(match.col) + ' ' + match.path + '\n';
+                std::lock_guard<std::mutex> guard(client_list_mutex);
+                client.send(reply, C_SEARCH);
+                break;
+            }
+            case C_FIND: {
+                // "id text", see send_matches
+                if(!client.doc)
+                    break;
+                size_t space = message.find(' ');
+                if(space == string::npos)
+                    break;
+                send_matches(
+                    client, message.substr(0, space), message.substr(space + 1));
                 break;
             }
             case C_OPEN_FILE_REQUEST: {
                 PERROR("Client " << clientId << " ask to open file "
                                  << message);
+                server_close_file(client, clientId);
                 client.filename = std::move(message);
                 // check if the file is already opened
                 file_map_mutex.lock();
                 if(file_map.find(client.filename) == file_map.end())
                     server_open_file(client.filename);
-                // const auto& file_vec = file_map.at(client.filename);
-                client.file_vec = &(file_map.at(client.filename));
+                OpenFile& file = file_map.at(client.filename);
+                client.doc     = file.doc;
+                client.log     = file.log;
+                file.last_used = get_timestamp();
                 file_map_mutex.unlock();
 
                 client.receive(message, command);
-    int lines_to_send = std::min<unsigned long>( std::stoul(message), client.file_vec->size());
-                client.begloc      = 0;
-                client.rownum      = lines_to_send;
-                client.currloc     = 0;
                 client.client_list = &client_list;
-                client.send(to_string(lines_to_send), C_RESPONSE_FILE_INFO);
-                client.send(to_string(client.file_vec->size()));
-                // send contents line by line
-                for(int i = 0; i < lines_to_send; ++i)
-                    client.send(client[i]);
-                client_list_mutex.lock();
-                client.isready = true;
-                client_list_mutex.unlock();
-                PERROR("Sent " << lines_to_send << " lines.");
-
-                // client.send("This is just a placeholder for the actual
-                // file.",
-                //             C_RESPONSE_FILE_INFO);
-
+                send_viewport(client, 0, std::stoul(message), clientId);
+                break;
+            }
+            case C_REQUEST_VIEWPORT: {
+                if(!client.doc)
+                    break;
+                size_t first, rows;
+                std::istringstream(message) >> first >> rows;
+                send_viewport(client, first, rows, clientId);
                 break;
             }
             case C_PUSH_LINE_BACK: {
@@ -208,17 +314,25 @@ void message_handler(size_t clientId) {
                                << " to client "
                                << clientId);
                 size_t line_to_send = std::stoul(message);
-                client.begloc       = line_to_send - client.rownum;
-                client.currloc      = line_to_send;
-                // if(file_vec.size() < line_to_send)
-                //     client.send("~", C_PUSH_LINE_BACK);  // shouldn't happen
-                // else
-                client.send(client[line_to_send], C_PUSH_LINE_BACK);
+                client.set_top(line_to_send >= client.rownum
+                                   ? line_to_send - client.rownum
+                                   : 0);
+                client.set_cursor(line_to_send);
+                send_line(client, line_to_send, C_PUSH_LINE_BACK);
                 break;
             }
             case C_ADD_LINE_BACK: {
                 size_t line_to_send = std::stoul(message);
-                client.send(client[line_to_send], C_ADD_LINE_BACK);
+                send_line(client, line_to_send, C_ADD_LINE_BACK);
+                break;
+            }
+            case C_FETCH_LINES: {
+                // read ahead of the client's window, see send_block
+                if(!client.doc)
+                    break;
+                size_t first, count;
+                if(std::istringstream(message) >> first >> count)
+                    send_block(client, first, count);
                 break;
             }
             case C_PUSH_LINE_FRONT: {
@@ -226,32 +340,66 @@ void message_handler(size_t clientId) {
                                << " to client "
                                << clientId);
                 size_t line_to_send = std::stoul(message);
-                client.begloc       = line_to_send;
-                client.currloc      = line_to_send;
-                client.send(client[line_to_send], C_PUSH_LINE_FRONT);
+                client.set_top(line_to_send);
+                client.set_cursor(line_to_send);
+                send_line(client, line_to_send, C_PUSH_LINE_FRONT);
                 break;
             }
-            case C_UPDATE_LINE_CONTENT: {
-                if(!client.isediting)
+            case C_APPLY_OPS: {
+                uint64_t base_revision;
+                vector<Operation> ops;
+                if(!client.doc || !decode_batch(message, base_revision, ops))
                     break;
-                // size_t line_to_update = std::stoi(message);
-                // client.receive(message, command);
-                client.broadcast(to_string(client.currloc),
-                                 C_UPDATE_LINE_CONTENT);
-                client.broadcast(client.update_line(std::move(message)),
-                                 C_UPDATE_LINE_CONTENT);
-                // TODO: broadcast change to all clients under this file
+                for(Operation& op : ops)
+                    op.author = clientId;
+                // the ops are acknowledged and broadcast from the callback
+                // so every client receives them in revision order
+                bool applied = client.doc->apply(
+                    ops, base_revision, [&client](const vector<Operation>& ops) {
+                        client.log->append(ops);
+                        std::lock_guard<std::mutex> guard(client_list_mutex);
+                        client.publish(ops);
+                    });
+                if(!applied) {
+                    // too far behind to transform, start over from the
+                    // current version
+                    PERROR("Client " << clientId << " is out of sync");
+                    send_viewport(client, client.top(), client.rownum,
+                                  clientId);
+                }
                 break;
             }
-            case C_SET_CURSOR_POS: {
-                if(!client.isediting) {
-                    client.currloc = std::stoul(message);
+            case C_UNDO:
+            case C_REDO: {
+                if(!client.doc) {
+                    client.send("0", command);
                     break;
                 }
-
+                // the reverting ops go out like any other edit, the
+                // client asking for them included
+                auto notify = [&client](const vector<Operation>& ops) {
+                    client.log->append(ops);
+                    std::lock_guard<std::mutex> guard(client_list_mutex);
+                    client.publish(ops, true);
+                };
+                bool done = command == C_UNDO
+                                ? client.doc->undo(clientId, notify)
+                                : client.doc->redo(clientId, notify);
+                client.send(done ? "1" : "0", command);
+                break;
+            }
+            case C_SET_CURSOR_POS: {
                 // client[client.currloc].m.unlock();
-                client.currloc = std::stoul(message);
+                client.set_cursor(std::stoul(message));
                 // client[client.currloc].m.lock();
+                if(client.doc)
+                    client.follow_cursor();
+                break;
+            }
+            case C_RESIZE_VIEWPORT: {
+                // the client's terminal was resized, it fetches the rows
+                // it gained itself and moves begloc with C_SET_CURSOR_POS
+                client.rownum = std::stoul(message);
                 break;
             }
             case C_SWITCH_TO_BROWSING_MODE: {
@@ -270,65 +418,431 @@ void message_handler(size_t clientId) {
                 }
                 break;
             }
-            case C_SAVE_FILE: {
-                // save the file and inform the client when we are done
-                server_save_file(client.filename);
-                client.send("", C_SAVE_FILE);
-            }
-            case C_INSERT_LINE: {
-                if(!client.isediting)
+            case C_GET_STATS: {
+                if(!client.doc) {
+                    client.send("", C_GET_STATS);
                     break;
-                // the line before breaking should have already been
-                // updated... the line should be inserted after
-                // current row
-
-                client.insert_line(message);
-                client.broadcast(to_string(client.currloc), C_INSERT_LINE);
-                client.broadcast(message, C_INSERT_LINE);
+                }
+                // unsaved edits, save lag in ms, queued saves of the file
+                // and of every file, memory held by the undo history
+                Document::Status status = client.doc->status();
+                uint64_t lag            = 0;
+                if(status.dirty_since)
+                    lag = (get_timestamp() - status.dirty_since) / 1000000;
+                client.send(
+                    to_string(status.revision - status.saved_revision) + ' ' +
+                        to_string(lag) + ' ' +
+                        to_string(saver.queued(client.filename)) + ' ' +
+                        to_string(saver.queue_depth()) + ' ' +
+                        to_string(status.undo_bytes),
+                    C_GET_STATS);
                 break;
             }
-            case C_DELETE_LINE: {
-                if(!client.isediting)
+            case C_SAVE_FILE: {
+                if(!client.doc) {
+                    client.send("0", C_SAVE_FILE);
                     break;
-                size_t line_to_delete = std::stoul(message);
-                client.delete_line(line_to_delete);
-                client.broadcast(message, C_DELETE_LINE);
+                }
+                // save in the background, saves of the same file coalesce
+                // and the client is told once one covers this request
+                string filename = client.filename;
+                saver.request(
+                    filename,
+                    client.doc->snapshot()->get_revision(),
+                    [filename](Document::SaveStats& stats) {
+                        return server_save_file(filename, stats);
+                    },
+                    &client,
+                    [&client](bool ok, const Document::SaveStats& stats) {
+                        client.send(ok ? "1" : "0", C_SAVE_FILE);
+                    });
+                break;
             }
         }
     }
 
     cout << "Client " << clientId << " left." << endl;
+    saver.forget(&client);
+    server_close_file(client, clientId);
     client_list_mutex.lock();
     client_list.erase(iter_self);
     client_list_mutex.unlock();
 }
 
+void file_list_changed(const string& name, FileWatcher::Change change) {
+    if(name.back() != '/') {
+        if(change == FileWatcher::REMOVED)
+            search_index.remove(name);
+        else
+            search_index.update(name);
+    }
+    if(change == FileWatcher::MODIFIED)
+        return;
+    bool added = change == FileWatcher::ADDED;
+    PERROR("File " << name << (added ? " added" : " removed"));
+    std::lock_guard<std::mutex> guard(client_list_mutex);
+    for(ClientSocket& client : client_list)
+        if(client.watching)
+            client.send(name, added ? C_FILE_ADDED : C_FILE_REMOVED);
+}
+
+void autosave() {
+    const uint64_t second = 1000000000;
+    // paces the writes themselves, so a large file is not written at
+    // full speed; shared with the saves, which may outlive this frame
+    auto budget = std::make_shared<WriteBudget>(autosave_rate * 1024);
+    std::atomic<bool> busy(false);  // an autosave is queued or running
+    while(running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        evict_idle();
+        checkpoint_logs();
+        index_edits();
+        if(!autosave_interval || busy || !budget->available())
+            continue;
+
+        // pick the file whose unsaved edits are the oldest
+        uint64_t now = get_timestamp();
+        string due;
+        uint64_t revision = 0, oldest = now;
+        file_map_mutex.lock();
+        for(auto& entry : file_map) {
+            Document::Status status = entry.second.doc->status();
+            uint64_t unsaved = status.revision - status.saved_revision;
+            if(!unsaved || !status.dirty_since ||
+               status.dirty_since >= oldest)
+                continue;
+            if(unsaved >= autosave_edits ||
+               now - status.dirty_since >= autosave_interval * second) {
+                due      = entry.first;
+                revision = status.revision;
+                oldest   = status.dirty_since;
+            }
+        }
+        file_map_mutex.unlock();
+        if(due.empty() || saver.queued(due))
+            continue;
+
+        PERROR("Autosaving " << due);
+        busy = true;
+        saver.request(
+            due,
+            revision,
+            [due, budget](Document::SaveStats& stats) {
+                return server_save_file(due, stats, [budget](size_t bytes) {
+                    budget->take(bytes);
+                });
+            },
+            &busy,
+            [&busy](bool ok, const Document::SaveStats& stats) {
+                busy = false;
+            });
+    }
+    // the callback refers to this frame; a save still queued is written
+    // at full speed so shutting down does not wait on the budget
+    saver.forget(&busy);
+    budget->close();
+}
+
+void send_viewport(ClientSocket& client,
+                   size_t first,
+                   size_t rows,
+                   size_t clientId) {
+    std::lock_guard<std::mutex> list_guard(client_list_mutex);
+    std::lock_guard<std::recursive_mutex> guard(client.get_send_mutex());
+    // ops published from now on reach the client after these lines, the
+    // ones already in the snapshot are skipped by ClientSocket::publish;
+    // a client staying on the file is answered at its revision, so it
+    // does not miss the batch on its way and what it keeps in step with
+    // the ops, like its search matches, stays right
+    auto snapshot   = client.isready ? client.doc->snapshot(client.revision)
+                                     : client.doc->snapshot();
+    client.isready  = true;
+    client.revision = snapshot->get_revision();
+    first           = std::min(first, snapshot->size() - 1);
+    size_t lines_to_send = std::min(rows, snapshot->size() - first);
+    client.rownum        = lines_to_send;
+    client.set_top(first);
+    client.set_cursor(first);
+    client.send(to_string(lines_to_send), C_RESPONSE_FILE_INFO);
+    client.send(to_string(snapshot->size()) + ' ' + to_string(first) + ' ' +
+                to_string(client.revision) + ' ' + to_string(clientId));
+    // send contents line by line
+    for(size_t i = 0; i < lines_to_send; ++i)
+        client.send((*snapshot)[first + i]);
+    PERROR("Sent " << lines_to_send << " lines.");
+}
+
+void send_matches(ClientSocket& client, const string& id, const string& text) {
+    // at the revision the client is at, the ops it gets after that are
+    // what it moves the hits across
+    Document::Snapshot snapshot;
+    {
+        std::lock_guard<std::recursive_mutex> guard(client.get_send_mutex());
+        snapshot = client.doc->snapshot(client.revision);
+    }
+    string header = id + ' ' + to_string(snapshot->get_revision()) + ' ';
+    string hits;
+    size_t count = 0;
+    for(size_t i = 0; i < snapshot->size() && !text.empty(); ++i) {
+        const string& line = (*snapshot)[i];
+        for(size_t col = 0;; ++col) {
+            col = find_substring(line.data(), line.size(), text, col);
+            if(col == string::npos)
+                break;
+            hits += to_string(i) + ' ' + to_string(col) + '\n';
+            if(++count % find_batch)
+                continue;
+            // the client can jump to the first ones while the rest of the
+            // document is scanned
+            std::lock_guard<std::mutex> guard(client_list_mutex);
+            client.send(header + "0\n" + hits, C_FIND);
+            hits.clear();
+        }
+    }
+    std::lock_guard<std::mutex> guard(client_list_mutex);
+    client.send(header + "1\n" + hits, C_FIND);
+}
+
+void send_line(ClientSocket& client, size_t linenum, int command) {
+    std::lock_guard<std::recursive_mutex> guard(client.get_send_mutex());
+    // the line has to match the ops the client has received so far
+    auto snapshot = client.doc->snapshot(client.revision);
+    client.send(to_string(linenum) + ' ' + (*snapshot)[linenum], command);
+}
+
+void send_block(ClientSocket& client, size_t first, size_t count) {
+    std::lock_guard<std::recursive_mutex> guard(client.get_send_mutex());
+    auto snapshot = client.doc->snapshot(client.revision);
+    first         = std::min(first, snapshot->size());
+    count         = std::min({count, max_block, snapshot->size() - first});
+    string reply  = to_string(first) + '\n';
+    for(size_t i = 0; i < count; ++i) {
+        reply += (*snapshot)[first + i];
+        reply.push_back('\n');
+    }
+    client.send(reply, C_FETCH_LINES);
+}
+
+string state_path(const string& filename, const string& suffix) {
+    string result = base_directory + log_directory;
+    for(char c : filename) {
+        if(c == '%')
+            result += "%25";
+        else if(c == '/')
+            result += "%2F";
+        else
+            result.push_back(c);
+    }
+    return result + suffix;
+}
+
 void server_open_file(const string& filename) {
     PERROR("Open file " << filename);
-    std::ifstream fin(base_directory + filename);
-    if(!fin.is_open())
-        PERROR("Failed to open " << filename);
     // use the bracket operator to create a new entry
-    auto& file_vec = file_map[filename];
-    // read and store the entire file into the vector
-    string temp;
-    while(std::getline(fin, temp)) {
-        while(!temp.empty() && (temp.back() == '\n' || temp.back() == '\r' ||
-                                temp.back() == '\0'))
-            temp.pop_back();  // remove new lines and null characters
-        file_vec.emplace_back(temp);
+    OpenFile& file = file_map[filename];
+    file.doc       = std::make_shared<Document>();
+    file.log       = std::make_shared<OpLog>();
+    Document& doc  = *file.doc;
+    const string path = base_directory + filename;
+    // the logged ops up to this are already in what is loaded
+    uint64_t since = 0;
+    if(doc.restore(state_path(filename, ".ckpt"), path)) {
+        PERROR("Restored " << filename << " from its checkpoint");
+        since = doc.status().checkpoint_revision;
+    } else {
+        std::ifstream fin(path);
+        if(!fin.is_open())
+            PERROR("Failed to open " << filename);
+        // read the entire file, then publish it as the first version
+        vector<string> lines;
+        string temp;
+        bool clean = true;  // whether saving would write the same bytes back
+        while(std::getline(fin, temp)) {
+            clean = clean && !fin.eof();  // the last line lacks its '\n'
+            while(!temp.empty() &&
+                  (temp.back() == '\n' || temp.back() == '\r' ||
+                   temp.back() == '\0')) {
+                temp.pop_back();  // remove new lines and null characters
+                clean = false;
+            }
+            lines.push_back(std::move(temp));
+        }
+        // a crash between a save and cutting the log back leaves ops in
+        // the log that the file holds too
+        since = Document::marked_revision(state_path(filename, ".saved"),
+                                          path);
+        doc.load(std::move(lines), clean ? path : "", since);
     }
+
+    // edits that were never saved are replayed on top of the file
+    ::mkdir((base_directory + log_directory).c_str(), 0755);
+    vector<Operation> ops;
+    OpLog& log = *file.log;
+    if(!log.open(state_path(filename, ".log"), ops))
+        PERROR("Failed to open the log of " << filename);
+    ops.erase(std::remove_if(ops.begin(),
+                             ops.end(),
+                             [since](const Operation& op) {
+                                 return op.revision <= since;
+                             }),
+              ops.end());
+    if(ops.empty())
+        return;
+    cout << "Recovering " << ops.size() << " unsaved edits of " << filename
+         << endl;
+    doc.apply(ops, doc.snapshot()->get_revision(),
+              [](const vector<Operation>& ops) {});
+    // the authors of these are gone
+    doc.clear_undo();
+    // the replayed ops got new revisions
+    log.rewrite(ops);
 }
 
-void server_save_file(const string& filename) {
+bool server_save_file(const string& filename,
+                      Document::SaveStats& stats,
+                      const std::function<void(size_t)>& pace) {
     PERROR("Saving file" << filename);
-    std::ofstream fout(base_directory + filename);
-    if(!fout.is_open())
-        PERROR("Failed to save " << filename);
-    // if the vector does not exist, we will simply create
-    // an empty file
-    auto& file_vec = file_map[filename];
-    for(const string& s : file_vec)
-        fout << s << '\n';
-    fout << std::flush;
+    std::shared_ptr<Document> doc;
+    std::shared_ptr<OpLog> log;
+    {
+        // holding the handles keeps the file from being evicted meanwhile
+        std::lock_guard<std::mutex> guard(file_map_mutex);
+        auto iter = file_map.find(filename);
+        if(iter == file_map.end())
+            return false;
+        doc = iter->second.doc;
+        log = iter->second.log;
+    }
+    // writes from a snapshot, editing goes on meanwhile
+    if(!doc->save(base_directory + filename,
+                  state_path(filename, ".tmp"),
+                  state_path(filename, ".saved"),
+                  stats,
+                  pace)) {
+        cerr << "Failed to save " << filename << endl;
+        return false;
+    }
+    cout << "Saved " << filename << ": " << stats.bytes_written
+         << " bytes written, " << stats.bytes_copied << " of "
+         << stats.file_size << " reused" << endl;
+
+    // the file is on disk, the log only needs the later edits
+    ::unlink(state_path(filename, ".ckpt").c_str());
+    log->checkpoint(stats.revision);
+    return true;
+}
+
+bool server_checkpoint_file(const string& filename,
+                            Document::SaveStats& stats) {
+    std::shared_ptr<Document> doc;
+    std::shared_ptr<OpLog> log;
+    {
+        std::lock_guard<std::mutex> guard(file_map_mutex);
+        auto iter = file_map.find(filename);
+        if(iter == file_map.end())
+            return false;
+        doc = iter->second.doc;
+        log = iter->second.log;
+    }
+    const string path = state_path(filename, ".ckpt");
+    if(!doc->checkpoint(path, path + ".tmp", base_directory + filename,
+                        stats)) {
+        cerr << "Failed to checkpoint " << filename << endl;
+        return false;
+    }
+    cout << "Checkpointed " << filename << ": " << stats.bytes_written
+         << " bytes written" << endl;
+    log->checkpoint(stats.revision);
+    return true;
+}
+
+void server_close_file(ClientSocket& client, size_t clientId) {
+    if(!client.doc)
+        return;
+    {
+        // no more ops of the file, the next one starts from its latest
+        // version
+        std::lock_guard<std::recursive_mutex> guard(client.get_send_mutex());
+        client.isready = false;
+    }
+    client.doc->clear_undo(clientId);
+    std::lock_guard<std::mutex> guard(file_map_mutex);
+    auto iter = file_map.find(client.filename);
+    if(iter != file_map.end())
+        iter->second.last_used = get_timestamp();
+    client.doc.reset();
+    client.log.reset();
+}
+
+void evict_idle() {
+    if(!memory_budget)
+        return;
+    const size_t budget = size_t(memory_budget) << 20;
+    vector<OpenFile> evicted;  // closed once the lock is released
+    {
+        std::lock_guard<std::mutex> guard(file_map_mutex);
+        size_t total = 0;
+        vector<std::pair<uint64_t, string>> idle;
+        for(auto& entry : file_map) {
+            const OpenFile& file = entry.second;
+            total += file.doc->snapshot()->get_bytes();
+            // no client nor save holds it
+            if(file.doc.use_count() == 1 && file.log.use_count() == 1)
+                idle.emplace_back(file.last_used, entry.first);
+        }
+        if(total <= budget)
+            return;
+        std::sort(idle.begin(), idle.end());
+        for(const auto& candidate : idle) {
+            if(total <= budget)
+                break;
+            const string& filename  = candidate.second;
+            OpenFile& file          = file_map.at(filename);
+            Document::Status status = file.doc->status();
+            if(saver.queued(filename))
+                continue;  // wait for the save to be over
+            if(status.revision != status.saved_revision) {
+                // save it first, it goes once clean on a later tick
+                saver.request(filename,
+                              status.revision,
+                              [filename](Document::SaveStats& stats) {
+                                  return server_save_file(filename, stats);
+                              });
+                continue;
+            }
+            cout << "Unloading " << filename << endl;
+            total -= file.doc->snapshot()->get_bytes();
+            evicted.push_back(std::move(file));
+            file_map.erase(filename);
+        }
+    }
+}
+
+void checkpoint_logs() {
+    std::lock_guard<std::mutex> guard(file_map_mutex);
+    for(auto& entry : file_map) {
+        Document::Status status = entry.second.doc->status();
+        uint64_t since = std::max(status.saved_revision,
+                                  status.checkpoint_revision);
+        const string& filename = entry.first;
+        const string key       = "checkpoint:" + filename;
+        if(status.revision - since < checkpoint_edits || saver.queued(key))
+            continue;
+        saver.request(key,
+                      status.revision,
+                      [filename](Document::SaveStats& stats) {
+                          return server_checkpoint_file(filename, stats);
+                      });
+    }
+}
+
+void index_edits() {
+    std::lock_guard<std::mutex> guard(file_map_mutex);
+    for(auto& entry : file_map) {
+        Document::Snapshot version = entry.second.doc->snapshot();
+        if(version->get_revision() == entry.second.indexed)
+            continue;
+        search_index.update(entry.first, version);
+        entry.second.indexed = version->get_revision();
+    }
 }
@@ -1,22 +1,71 @@
 #ifndef __NSERVER_H__
 #define __NSERVER_H__
 
+#include <cinttypes>
 #include <climits>
+#include <functional>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <string>
 #include "socket.h"
+#include "watcher.h"
 using std::endl;
 using std::cout;
 using std::string;
 using std::list;
 
+// a loaded file, shared by the clients editing it
+struct OpenFile {
+    std::shared_ptr<Document> doc;
+    std::shared_ptr<OpLog> log;
+    uint64_t last_used = 0;  // when a client last opened or left it
+    uint64_t indexed   = 0;  // revision search_index last got
+};
+
 void int_handler(int sig);
 int run_server();
 void message_handler(size_t clientId);
+// keep search_index up to date with name, and tell every client holding
+// the file list if it came or went
+void file_list_changed(const string& name, FileWatcher::Change change);
+// save files with old or many unsaved edits, within an I/O budget
+void autosave();
+// send rows lines starting at first, along with the revision they are at
+void send_viewport(ClientSocket& client,
+                   size_t first,
+                   size_t rows,
+                   size_t clientId);
+// Send every match of text in the client's document as "line col", in
+// C_FIND messages of find_batch matches headed by "id revision last"; the
+// message with last set to 1 ends them.
+void send_matches(ClientSocket& client, const string& id, const string& text);
+// send a single line prefixed by its line number
+void send_line(ClientSocket& client, size_t linenum, int command);
+// send up to count lines starting at first in one C_FETCH_LINES message,
+// "first\n" followed by each line ended by '\n'
+void send_block(ClientSocket& client, size_t first, size_t count);
+// a file the server keeps about filename, all of them sit directly in
+// log_directory whatever directory filename is in
+string state_path(const string& filename, const string& suffix);
+// with file_map_mutex held
 void server_open_file(const string& filename);
-void server_save_file(const string& filename);
+// let go of the file the client is on, and of what clientId could undo
+void server_close_file(ClientSocket& client, size_t clientId);
+// unload the least recently used idle files while over memory_budget
+void evict_idle();
+// runs on the save thread, see Saver; pace as in Document::save
+bool server_save_file(const string& filename,
+                      Document::SaveStats& stats,
+                      const std::function<void(size_t)>& pace = nullptr);
+// write a checkpoint and cut the log behind it, on the save thread too
+bool server_checkpoint_file(const string& filename,
+                            Document::SaveStats& stats);
+// checkpoint files whose logs grew past checkpoint_edits
+void checkpoint_logs();
+// hand search_index the open files edited since it last saw them
+void index_edits();
 // ssize_t broadcast(const list<ClientSocket>& client_list,
 //                   const string& filename,
 //                   const string& message,